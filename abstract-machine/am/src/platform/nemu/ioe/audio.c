@@ -8,19 +8,69 @@
 #define AUDIO_INIT_ADDR      (AUDIO_ADDR + 0x10)
 #define AUDIO_COUNT_ADDR     (AUDIO_ADDR + 0x14)
 
+static uint32_t sbuf_size = 0;
+static uint32_t wpos = 0; // the producer side of the stream buffer ring
+
+// The device is probed at the first AM_AUDIO_CONFIG, and not in ioe_init(),
+// since touching the registers of a missing device stops NEMU.
+static void audio_probe() {
+  if (sbuf_size == 0) sbuf_size = inl(AUDIO_SBUF_SIZE_ADDR);
+}
+
 void __am_audio_init() {
 }
 
 void __am_audio_config(AM_AUDIO_CONFIG_T *cfg) {
-  cfg->present = false;
+  audio_probe();
+  cfg->present = (sbuf_size != 0);
+  cfg->bufsize = sbuf_size;
 }
 
 void __am_audio_ctrl(AM_AUDIO_CTRL_T *ctrl) {
+  audio_probe();
+  // NEMU empties the stream buffer on initialization
+  wpos = 0;
+  outl(AUDIO_FREQ_ADDR, ctrl->freq);
+  outl(AUDIO_CHANNELS_ADDR, ctrl->channels);
+  outl(AUDIO_SAMPLES_ADDR, ctrl->samples);
+  outl(AUDIO_INIT_ADDR, 1);
 }
 
 void __am_audio_status(AM_AUDIO_STATUS_T *stat) {
-  stat->count = 0;
+  stat->count = inl(AUDIO_COUNT_ADDR);
+}
+
+static void sbuf_write(const uint8_t *src, uint32_t len) {
+  while (len > 0) {
+    uint32_t n = sbuf_size - wpos;
+    if (n > len) n = len;
+    if (((wpos | n | (uintptr_t)src) & 3) == 0) {
+      for (uint32_t i = 0; i < n; i += 4) {
+        outl(AUDIO_SBUF_ADDR + wpos + i, *(uint32_t *)(src + i));
+      }
+    } else {
+      for (uint32_t i = 0; i < n; i ++) {
+        outb(AUDIO_SBUF_ADDR + wpos + i, src[i]);
+      }
+    }
+    src += n;
+    len -= n;
+    wpos = (wpos + n) % sbuf_size;
+  }
 }
 
 void __am_audio_play(AM_AUDIO_PLAY_T *ctl) {
+  audio_probe();
+  const uint8_t *src = ctl->buf.start;
+  uint32_t len = (uint8_t *)ctl->buf.end - (uint8_t *)ctl->buf.start;
+  while (len > 0) {
+    // writing to the count register adds the bytes to the queue
+    uint32_t nfree = sbuf_size - inl(AUDIO_COUNT_ADDR);
+    uint32_t n = (len < nfree ? len : nfree);
+    if (n == 0) continue;
+    sbuf_write(src, n);
+    outl(AUDIO_COUNT_ADDR, n);
+    src += n;
+    len -= n;
+  }
 }
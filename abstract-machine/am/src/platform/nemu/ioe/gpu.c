@@ -2,15 +2,24 @@
 #include <nemu.h>
 
 #define SYNC_ADDR (VGACTL_ADDR + 4)
+#define CMD_ADDR  (VGACTL_ADDR + 8)
+#define ARG0_ADDR (VGACTL_ADDR + 12)
+#define ARG1_ADDR (VGACTL_ADDR + 16)
+#define ARG2_ADDR (VGACTL_ADDR + 20)
+#define TMEM_SIZE_ADDR (VGACTL_ADDR + 24)
+
+#define GPU_CMD_MEMCPY 1
+#define GPU_CMD_RENDER 2
 
 void __am_gpu_init() {
 }
 
 void __am_gpu_config(AM_GPU_CONFIG_T *cfg) {
+  uint32_t size = inl(VGACTL_ADDR);
   *cfg = (AM_GPU_CONFIG_T) {
-    .present = true, .has_accel = false,
-    .width = 0, .height = 0,
-    .vmemsz = 0
+    .present = true, .has_accel = (inl(TMEM_SIZE_ADDR) != 0),
+    .width = size >> 16, .height = size & 0xffff,
+    .vmemsz = inl(TMEM_SIZE_ADDR)
   };
 }
 
@@ -23,3 +32,15 @@ void __am_gpu_fbdraw(AM_GPU_FBDRAW_T *ctl) {
 void __am_gpu_status(AM_GPU_STATUS_T *status) {
   status->ready = true;
 }
+
+void __am_gpu_memcpy(AM_GPU_MEMCPY_T *params) {
+  outl(ARG0_ADDR, params->dest);
+  outl(ARG1_ADDR, (uintptr_t)params->src);
+  outl(ARG2_ADDR, params->size);
+  outl(CMD_ADDR, GPU_CMD_MEMCPY);
+}
+
+void __am_gpu_render(AM_GPU_RENDER_T *params) {
+  outl(ARG0_ADDR, params->root);
+  outl(CMD_ADDR, GPU_CMD_RENDER);
+}
@@ -0,0 +1,80 @@
+#include <am.h>
+#include <nemu.h>
+#include <klib.h>
+
+#define NET_PRESENT_ADDR   (NET_ADDR + 0x00)
+#define NET_TX_RING_ADDR   (NET_ADDR + 0x04)
+#define NET_RX_RING_ADDR   (NET_ADDR + 0x08)
+#define NET_RING_SIZE_ADDR (NET_ADDR + 0x0c)
+#define NET_TX_HEAD_ADDR   (NET_ADDR + 0x10)
+#define NET_TX_TAIL_ADDR   (NET_ADDR + 0x14)
+#define NET_RX_HEAD_ADDR   (NET_ADDR + 0x18)
+#define NET_RX_TAIL_ADDR   (NET_ADDR + 0x1c)
+
+#define NR_DESC 16
+#define RX_BUF_SIZE 2048
+
+typedef struct {
+  uint32_t addr, len, flags, reserved;
+} NetDesc;
+
+static NetDesc tx_ring[NR_DESC], rx_ring[NR_DESC];
+static uint8_t rx_buf[NR_DESC][RX_BUF_SIZE];
+static uint32_t tx_tail = 0, rx_next = 0;
+static bool ready = false;
+
+static void rx_post(uint32_t idx) {
+  NetDesc *d = &rx_ring[idx % NR_DESC];
+  d->addr = (uintptr_t)rx_buf[idx % NR_DESC];
+  d->len = RX_BUF_SIZE;
+  d->flags = 0;
+}
+
+// The rings are handed to the card at the first AM_NET_CONFIG, which finds
+// the card, and not in ioe_init(), since touching the registers of a
+// missing card stops NEMU.
+static void net_setup() {
+  outl(NET_TX_RING_ADDR, (uintptr_t)tx_ring);
+  outl(NET_RX_RING_ADDR, (uintptr_t)rx_ring);
+  outl(NET_RING_SIZE_ADDR, NR_DESC);
+  for (int i = 0; i < NR_DESC; i ++) rx_post(i);
+  outl(NET_RX_TAIL_ADDR, NR_DESC);
+  ready = true;
+}
+
+void __am_net_config(AM_NET_CONFIG_T *cfg) {
+  cfg->present = inl(NET_PRESENT_ADDR);
+  if (cfg->present && !ready) net_setup();
+}
+
+// rx_len is the size of the next received packet, or 0 if there is none.
+// tx_len is the number of packets which are not sent yet, which is always 0,
+// since the card sends the packets when they are handed to it.
+void __am_net_status(AM_NET_STATUS_T *stat) {
+  if (!ready) net_setup();
+  stat->rx_len = (rx_next != inl(NET_RX_HEAD_ADDR) ? rx_ring[rx_next % NR_DESC].len : 0);
+  stat->tx_len = tx_tail - inl(NET_TX_HEAD_ADDR);
+}
+
+void __am_net_tx(AM_NET_TX_T *tx) {
+  if (!ready) net_setup();
+  // the packet is sent before the write to the tail returns,
+  // so the descriptor can point to the buffer of the caller
+  NetDesc *d = &tx_ring[tx_tail % NR_DESC];
+  d->addr = (uintptr_t)tx->buf.start;
+  d->len = (uint8_t *)tx->buf.end - (uint8_t *)tx->buf.start;
+  d->flags = 0;
+  tx_tail ++;
+  outl(NET_TX_TAIL_ADDR, tx_tail);
+}
+
+void __am_net_rx(AM_NET_RX_T *rx) {
+  if (!ready) net_setup();
+  if (rx_next == inl(NET_RX_HEAD_ADDR)) return;
+  NetDesc *d = &rx_ring[rx_next % NR_DESC];
+  uint32_t len = (uint8_t *)rx->buf.end - (uint8_t *)rx->buf.start;
+  memcpy(rx->buf.start, (void *)(uintptr_t)d->addr, (len < d->len ? len : d->len));
+  rx_post(rx_next);
+  rx_next ++;
+  outl(NET_RX_TAIL_ADDR, rx_next + NR_DESC);
+}
@@ -1,11 +1,30 @@
 #include <am.h>
 #include <nemu.h>
 
+// see the clock page in nemu/src/device/timer.c
+#define PVCLOCK_MAGIC 0x4b435650
+
+static volatile uint32_t *pv = NULL;
+
 void __am_timer_init() {
+  // NEMU puts the address of the clock page after the time, 0 without it
+  pv = (uint32_t *)(uintptr_t)inl(RTC_ADDR + 8);
 }
 
 void __am_timer_uptime(AM_TIMER_UPTIME_T *uptime) {
-  uptime->us = 0;
+  if (pv != NULL && pv[1] == PVCLOCK_MAGIC) {
+    uint32_t seq, lo, hi;
+    do {
+      seq = pv[0];
+      lo = pv[2];
+      hi = pv[3];
+    } while ((seq & 1) || seq != pv[0]);
+    uptime->us = ((uint64_t)hi << 32) | lo;
+    return;
+  }
+  uint32_t hi = inl(RTC_ADDR + 4);
+  uint32_t lo = inl(RTC_ADDR);
+  uptime->us = ((uint64_t)hi << 32) | lo;
 }
 
 void __am_timer_rtc(AM_TIMER_RTC_T *rtc) {
@@ -0,0 +1,38 @@
+/***************************************************************************************
+* Copyright (c) 2014-2024 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+#ifndef __CHECKPOINT_H__
+#define __CHECKPOINT_H__
+
+#include <common.h>
+#include <setjmp.h>
+
+// sdb_mainloop() sets this, and a resumed checkpoint jumps back here to
+// call checkpoint_replay(), which runs forward to the requested instruction
+extern sigjmp_buf checkpoint_resume_point;
+
+void init_checkpoint();
+void checkpoint_replay();
+void checkpoint_reset();
+bool checkpoint_replaying();
+
+// cpu_exec() stops at the next checkpoint to take it, then goes on
+uint64_t checkpoint_next();
+void checkpoint_take();
+
+void checkpoint_reverse_step(uint64_t n);
+void checkpoint_reverse_continue();
+
+#endif
@@ -18,27 +18,57 @@
 
 #include <common.h>
 #include <difftest-def.h>
+#include <memory/vaddr.h>
 
 #ifdef CONFIG_DIFFTEST
 void difftest_skip_ref();
 void difftest_skip_dut(int nr_ref, int nr_dut);
+void difftest_mmio(paddr_t addr, int len, word_t data, bool is_write);
 void difftest_set_patch(void (*fn)(void *arg), void *arg);
 void difftest_step(vaddr_t pc, vaddr_t npc);
 void difftest_detach();
 void difftest_attach();
+void difftest_sync();
+#ifdef CONFIG_DIFFTEST_MODE_BATCH
+void difftest_journal(paddr_t addr, int len);
+#endif
+#ifdef CONFIG_DIFFTEST_MEMCHK
+extern uint64_t difftest_dirty_map[];
+
+// mark the page(s) of a pmem write to be compared in the next memory check
+static inline void difftest_mark_dirty(paddr_t addr, int len) {
+  paddr_t first = (addr - CONFIG_MBASE) >> PAGE_SHIFT;
+  paddr_t last = (addr + len - 1 - CONFIG_MBASE) >> PAGE_SHIFT;
+  difftest_dirty_map[first / 64] |= 1ull << (first % 64);
+  difftest_dirty_map[last / 64] |= 1ull << (last % 64);
+}
+#endif
 #else
 static inline void difftest_skip_ref() {}
 static inline void difftest_skip_dut(int nr_ref, int nr_dut) {}
+static inline void difftest_mmio(paddr_t addr, int len, word_t data, bool is_write) {}
 static inline void difftest_set_patch(void (*fn)(void *arg), void *arg) {}
 static inline void difftest_step(vaddr_t pc, vaddr_t npc) {}
 static inline void difftest_detach() {}
 static inline void difftest_attach() {}
+static inline void difftest_sync() {}
+#endif
+
+#ifdef CONFIG_TARGET_SHARE
+// called by REF to load from MMIO, which returns the value loaded by DUT
+word_t difftest_mmio_read(paddr_t addr, int len);
 #endif
 
 extern void (*ref_difftest_memcpy)(paddr_t addr, void *buf, size_t n, bool direction);
 extern void (*ref_difftest_regcpy)(void *dut, bool direction);
 extern void (*ref_difftest_exec)(uint64_t n);
 extern void (*ref_difftest_raise_intr)(uint64_t NO);
+extern uint64_t (*ref_difftest_memhash)(paddr_t addr, size_t n);
+extern void (*ref_difftest_memdirty)(uint64_t *map, size_t nr_page);
+extern void (*ref_difftest_mmio_inject)(paddr_t addr, int len, word_t data);
+// run `n` instructions, after which DUT is at `pc`, and it has executed the
+// instruction at `pc` `nr_visit` times during them
+extern void (*ref_difftest_exec_to)(uint64_t n, vaddr_t pc, uint64_t nr_visit);
 
 static inline bool difftest_check_reg(const char *name, vaddr_t pc, word_t ref, word_t dut) {
   if (ref != dut) {
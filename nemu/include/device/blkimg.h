@@ -0,0 +1,31 @@
+/***************************************************************************************
+* Copyright (c) 2014-2024 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+#ifndef __DEVICE_BLKIMG_H__
+#define __DEVICE_BLKIMG_H__
+
+#include <common.h>
+
+// A block device image. Without an overlay, writes go to the image file
+// directly. With an overlay, the image is only read, and written blocks are
+// stored in the overlay file instead, so that many runs can share one image.
+typedef struct BlkImg BlkImg;
+
+BlkImg* blkimg_open(const char *path, const char *overlay);
+uint64_t blkimg_size(BlkImg *img);
+void blkimg_read(BlkImg *img, uint64_t off, void *buf, size_t len);
+void blkimg_write(BlkImg *img, uint64_t off, const void *buf, size_t len);
+
+#endif
@@ -0,0 +1,46 @@
+/***************************************************************************************
+* Copyright (c) 2014-2024 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+#ifndef __DEVICE_IDLE_H__
+#define __DEVICE_IDLE_H__
+
+#include <common.h>
+
+#ifdef CONFIG_IDLE_DETECT
+enum { IDLE_WAIT_TIMER, IDLE_WAIT_INPUT };
+
+// Devices which the guest may poll call `idle_poll()` on every read.
+// A guest store outside the stack frame of the loop resets the detection,
+// so loops with side effects are never skipped.
+extern uint32_t idle_nr_spin;
+extern uint64_t idle_time_offset;
+
+void idle_poll(int wait);
+void idle_wfi();
+void idle_set_mode(const char *mode);
+void idle_store(paddr_t addr);
+
+static inline void idle_write(paddr_t addr) { if (idle_nr_spin > 0) idle_store(addr); }
+#else
+// wfi is only a hint, so it is a nop without idle detection
+static inline void idle_wfi() {}
+#endif
+
+// the clock seen by the guest, which runs ahead of the host in warp mode
+static inline uint64_t get_guest_time() {
+  return get_time() + MUXDEF(CONFIG_IDLE_DETECT, idle_time_offset, 0);
+}
+
+#endif
@@ -0,0 +1,57 @@
+/***************************************************************************************
+* Copyright (c) 2014-2024 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+#ifndef __HOSTCALL_DEF_H__
+#define __HOSTCALL_DEF_H__
+
+// The hostcall ABI. It does not depend on any NEMU header, so that guest
+// programs can include it directly.
+//
+// A hostcall is an `ebreak` with a7 = HOSTCALL_MAGIC. The service number
+// is passed in a0 and the arguments in a1-a3. The result is returned in a0,
+// a negative errno on failure. All pointers are guest physical addresses.
+//
+//   service          a1       a2       a3       a0 (a1)
+//   HOSTCALL_OPEN    path     flags    mode     fd
+//   HOSTCALL_CLOSE   fd                         0
+//   HOSTCALL_READ    fd       buf      len      bytes read
+//   HOSTCALL_WRITE   fd       buf      len      bytes written
+//   HOSTCALL_LSEEK   fd       offset   whence   new offset
+//   HOSTCALL_TIME                               time of the RTC in us (high half in a1)
+//   HOSTCALL_MEMCPY  dst      src      len      0
+//
+// fd 0, 1 and 2 are the stdin, stdout and stderr of NEMU.
+
+#define HOSTCALL_MAGIC 0x4e454d55 // "NEMU"
+
+enum {
+  HOSTCALL_OPEN = 1,
+  HOSTCALL_CLOSE,
+  HOSTCALL_READ,
+  HOSTCALL_WRITE,
+  HOSTCALL_LSEEK,
+  HOSTCALL_TIME,
+  HOSTCALL_MEMCPY,
+};
+
+// flags of HOSTCALL_OPEN
+#define HOSTCALL_O_RDONLY 0x0
+#define HOSTCALL_O_WRONLY 0x1
+#define HOSTCALL_O_RDWR   0x2
+#define HOSTCALL_O_CREAT  0x100
+#define HOSTCALL_O_TRUNC  0x200
+#define HOSTCALL_O_APPEND 0x400
+
+#endif
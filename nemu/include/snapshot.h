@@ -0,0 +1,52 @@
+/***************************************************************************************
+* Copyright (c) 2014-2024 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+#ifndef __SNAPSHOT_H__
+#define __SNAPSHOT_H__
+
+#include <common.h>
+#include <memory/vaddr.h>
+
+#ifdef CONFIG_SNAPSHOT
+extern uint64_t snapshot_dirty_map[];
+
+// mark the pages of a pmem write to be stored by the next snapshot,
+// which only stores the pages written since its base
+static inline void snapshot_mark_dirty(paddr_t addr, size_t len) {
+  if (len == 0) return;
+  paddr_t first = (addr - CONFIG_MBASE) >> PAGE_SHIFT;
+  paddr_t last = (addr + len - 1 - CONFIG_MBASE) >> PAGE_SHIFT;
+  for (paddr_t p = first; p <= last; p ++) {
+    snapshot_dirty_map[p / 64] |= 1ull << (p % 64);
+  }
+}
+
+// Devices register their internal states here, so that they are saved and
+// restored with snapshots. States are restored in the order of registration.
+void add_snapshot_state(const char *name, void *state, size_t len);
+
+bool snapshot_save(const char *file);
+bool snapshot_load(const char *file);
+// wait for the snapshot being written in the background
+void snapshot_wait();
+
+// the snapshot scheduled by --save-at, cpu_exec() stops there to save it
+uint64_t snapshot_save_at();
+void snapshot_save_scheduled();
+#else
+static inline void add_snapshot_state(const char *name, void *state, size_t len) {}
+#endif
+
+#endif
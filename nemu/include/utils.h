@@ -34,6 +34,27 @@ extern NEMUState nemu_state;
 
 uint64_t get_time();
 
+// ----------- hash -----------
+
+#define HASH64_INIT 0xcbf29ce484222325ull
+
+// A fast non-cryptographic hash which consumes the buffer 8 bytes at a time.
+// Hashing a buffer in pieces gives the same result as hashing it at once,
+// as long as every piece but the last has a length of multiple of 8.
+static inline uint64_t hash64(const void *buf, size_t len, uint64_t h) {
+  const uint8_t *p = (const uint8_t *)buf;
+  for (; len >= 8; len -= 8, p += 8) {
+    uint64_t w;
+    memcpy(&w, p, 8);
+    h = (h ^ w) * 0x9e3779b97f4a7c15ull;
+    h ^= h >> 32;
+  }
+  for (; len > 0; len --, p ++) {
+    h = (h ^ *p) * 0x100000001b3ull;
+  }
+  return h;
+}
+
 // ----------- log -----------
 
 #define ANSI_FG_BLACK   "\33[1;30m"
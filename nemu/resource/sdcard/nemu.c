@@ -49,6 +49,8 @@
 #define SDRSP2 0x18 /* SD card response (95:64)        - 32 R   */
 #define SDRSP3 0x1c /* SD card response (127:96)       - 32 R   */
 #define SDHSTS 0x20 /* SD host status                  - 11 R/W */
+#define SDDMAADDR 0x24 /* DMA address in memory (NEMU)  - 32 R/W */
+#define SDDMALEN  0x28 /* DMA length, write to start    - 32 R/W */
 #define SDVDD  0x30 /* SD card power control           -  1 R/W */
 #define SDEDM  0x34 /* Emergency Debug Mode            - 13 R/W */
 #define SDHCFG 0x38 /* Host configuration              -  2 R/W */
@@ -95,6 +97,7 @@ struct nemu_host {
 	struct mmc_data		*data;		/* Current data request */
 	bool			data_complete:1;/* Data finished before cmd */
 	bool			use_sbc:1;	/* Send CMD23 */
+	bool			use_dma:1;	/* Transfer by DMA */
 };
 
 static void nemu_reset(struct mmc_host *mmc)
@@ -175,6 +178,45 @@ static void nemu_transfer_pio(struct nemu_host *host)
 	nemu_transfer_block_pio(host, is_read);
 }
 
+static void nemu_transfer_dma(struct nemu_host *host)
+{
+	struct mmc_data *data = host->data;
+	struct device *dev = mmc_dev(host->mmc);
+	enum dma_data_direction dir;
+	struct scatterlist *sg;
+	int i, count;
+
+	dir = (data->flags & MMC_DATA_READ) ? DMA_FROM_DEVICE : DMA_TO_DEVICE;
+	count = dma_map_sg(dev, data->sg, data->sg_len, dir);
+	if (count == 0) {
+		data->error = -ENOMEM;
+		return;
+	}
+
+	/* every segment is moved by the device at once */
+	for_each_sg(data->sg, sg, count, i) {
+		writel(sg_dma_address(sg), host->ioaddr + SDDMAADDR);
+		writel(sg_dma_len(sg), host->ioaddr + SDDMALEN);
+	}
+
+	dma_unmap_sg(dev, data->sg, data->sg_len, dir);
+}
+
+static void nemu_transfer_data(struct nemu_host *host)
+{
+	int i;
+
+	if (host->use_dma) {
+		nemu_transfer_dma(host);
+		return;
+	}
+
+	// start PIO right now
+	for (i = 0; i < host->data->blocks; i ++) {
+		nemu_transfer_pio(host);
+	}
+}
+
 static
 void nemu_prepare_data(struct nemu_host *host, struct mmc_command *cmd)
 {
@@ -190,6 +232,10 @@ void nemu_prepare_data(struct nemu_host *host, struct mmc_command *cmd)
 	host->data_complete = false;
 	host->data->bytes_xfered = 0;
 
+	host->use_dma = data->blocks > PIO_THRESHOLD;
+	if (host->use_dma)
+		return;
+
   /* Use PIO */
   if (data->flags & MMC_DATA_READ)
     flags |= SG_MITER_TO_SG;
@@ -316,11 +362,7 @@ static void nemu_finish_command(struct nemu_host *host)
 		host->cmd = NULL;
 		if (nemu_send_command(host, host->mrq->cmd)) {
 			if (host->data) {
-        // start PIO right now
-        for (i = 0; i < host->data->blocks; i ++) {
-          nemu_transfer_pio(host);
-        }
-
+        nemu_transfer_data(host);
         nemu_finish_data(host);
       }
 
@@ -380,11 +422,7 @@ static void nemu_request(struct mmc_host *mmc, struct mmc_request *mrq)
 		}
 	} else if (mrq->cmd && nemu_send_command(host, mrq->cmd)) {
 		if (host->data) {
-      int i;
-      // start PIO right now
-      for (i = 0; i < host->data->blocks; i ++) {
-        nemu_transfer_pio(host);
-      }
+      nemu_transfer_data(host);
       nemu_finish_data(host);
     }
 
@@ -441,7 +479,7 @@ static int nemu_add_host(struct nemu_host *host)
 		return ret;
 	}
 
-	dev_info(dev, "loaded - DMA %s\n", "disabled");
+	dev_info(dev, "loaded - DMA %s\n", "enabled");
 
 	return 0;
 }
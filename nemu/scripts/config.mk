@@ -52,12 +52,16 @@ savedefconfig: $(CONF)
 	$(Q)$< $(silent) --defconfig=configs/$@ $(Kconfig)
 	$(Q)$< $(silent) --syncconfig $(Kconfig)
 
-.PHONY: menuconfig savedefconfig defconfig
+syncconfig: $(CONF) $(FIXDEP)
+	$(Q)$< $(silent) --syncconfig $(Kconfig)
+
+.PHONY: menuconfig savedefconfig defconfig syncconfig
 
 # Help text used by make help
 help:
 	@echo  '  menuconfig	  - Update current config utilising a menu based program'
 	@echo  '  savedefconfig   - Save current config as configs/defconfig (minimal config)'
+	@echo  '  syncconfig      - Update the generated headers after .config is changed'
 
 distclean: clean
 	-@rm -rf $(rm-distclean)
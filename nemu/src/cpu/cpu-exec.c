@@ -16,6 +16,8 @@
 #include <cpu/cpu.h>
 #include <cpu/decode.h>
 #include <cpu/difftest.h>
+#include <snapshot.h>
+#include <checkpoint.h>
 #include <locale.h>
 
 /* The assembly code of instructions executed is only output to the screen
@@ -31,7 +33,11 @@ static uint64_t g_timer = 0; // unit: us
 static bool g_print_step = false;
 
 void device_update();
+void serial_flush();
 void scan_all_wp(bool *stop);
+const char* hle_try_call(vaddr_t pc);
+void hle_statistic();
+void idle_statistic();
 
 static void trace_and_difftest(Decode *_this, vaddr_t dnpc) {
 #ifdef CONFIG_ITRACE_COND
@@ -83,6 +89,20 @@ static void exec_once(Decode *s, vaddr_t pc) {
 static void execute(uint64_t n) {
   Decode s;
   for (;n > 0; n --) {
+#ifdef CONFIG_HLE
+    s.pc = cpu.pc;
+    const char *fn = hle_try_call(s.pc);
+    if (fn != NULL) {
+      // the whole function is counted as one instruction, which is
+      // traced and checks the watchpoints like any other instruction
+      IFDEF(CONFIG_ITRACE, snprintf(s.logbuf, sizeof(s.logbuf), FMT_WORD ": <%s on host>", s.pc, fn));
+      g_nr_guest_inst ++;
+      trace_and_difftest(&s, cpu.pc);
+      if (nemu_state.state != NEMU_RUNNING) break;
+      IFDEF(CONFIG_DEVICE, device_update());
+      continue;
+    }
+#endif
     exec_once(&s, cpu.pc);
     g_nr_guest_inst ++;
     trace_and_difftest(&s, cpu.pc);
@@ -91,6 +111,15 @@ static void execute(uint64_t n) {
   }
 }
 
+// execute instructions without tracing, difftest and devices,
+// this is used by difftest to replay instructions in a batch, and by REF
+void cpu_exec_raw(uint64_t n) {
+  Decode s;
+  for (; n > 0; n --) {
+    exec_once(&s, cpu.pc);
+  }
+}
+
 static void statistic() {
   IFNDEF(CONFIG_TARGET_AM, setlocale(LC_NUMERIC, ""));
 #define NUMBERIC_FMT MUXDEF(CONFIG_TARGET_AM, "%", "%'") PRIu64
@@ -98,16 +127,36 @@ static void statistic() {
   Log("total guest instructions = " NUMBERIC_FMT, g_nr_guest_inst);
   if (g_timer > 0) Log("simulation frequency = " NUMBERIC_FMT " inst/s", g_nr_guest_inst * 1000000 / g_timer);
   else Log("Finish running in less than 1 us and can not calculate the simulation frequency");
+  IFDEF(CONFIG_HLE, hle_statistic());
+  IFDEF(CONFIG_IDLE_DETECT, idle_statistic());
 }
 
 void assert_fail_msg() {
+  IFDEF(CONFIG_HAS_SERIAL, serial_flush());
   isa_reg_display();
   statistic();
 }
 
+// the next instruction count where the monitor has work to do
+static uint64_t next_event() {
+  uint64_t at = UINT64_MAX;
+  IFDEF(CONFIG_SNAPSHOT, at = snapshot_save_at());
+#ifdef CONFIG_CHECKPOINT
+  if (checkpoint_next() < at) at = checkpoint_next();
+#endif
+  return at;
+}
+
+static void handle_event() {
+  IFDEF(CONFIG_SNAPSHOT, snapshot_save_scheduled());
+  IFDEF(CONFIG_CHECKPOINT, checkpoint_take());
+}
+
 /* Simulate how the CPU works. */
 void cpu_exec(uint64_t n) {
   g_print_step = (n < MAX_INST_TO_PRINT);
+  // the replay to a checkpoint target is not shown
+  IFDEF(CONFIG_CHECKPOINT, g_print_step = g_print_step && !checkpoint_replaying());
   switch (nemu_state.state) {
     case NEMU_END: case NEMU_ABORT: case NEMU_QUIT:
       printf("Program execution has ended. To restart the program, exit NEMU and run again.\n");
@@ -117,7 +166,19 @@ void cpu_exec(uint64_t n) {
 
   uint64_t timer_start = get_time();
 
-  execute(n);
+  // stop where the monitor has work to do, e.g. to save the scheduled
+  // snapshot, then go on
+  while (n > 0 && nemu_state.state == NEMU_RUNNING) {
+    uint64_t at = next_event();
+    uint64_t m = (at <= g_nr_guest_inst ? 0 : at - g_nr_guest_inst);
+    if (m > n) m = n;
+    execute(m);
+    n -= m;
+    handle_event();
+  }
+  // REF may still be behind, check the remaining instructions
+  IFDEF(CONFIG_DIFFTEST, difftest_sync());
+  IFDEF(CONFIG_HAS_SERIAL, serial_flush());
 
   uint64_t timer_end = get_time();
   g_timer += timer_end - timer_start;
@@ -18,6 +18,8 @@
 #include <isa.h>
 #include <cpu/cpu.h>
 #include <memory/paddr.h>
+#include <memory/host.h>
+#include <memory/vaddr.h>
 #include <utils.h>
 #include <difftest-def.h>
 
@@ -25,15 +27,313 @@ void (*ref_difftest_memcpy)(paddr_t addr, void *buf, size_t n, bool direction) =
 void (*ref_difftest_regcpy)(void *dut, bool direction) = NULL;
 void (*ref_difftest_exec)(uint64_t n) = NULL;
 void (*ref_difftest_raise_intr)(uint64_t NO) = NULL;
+uint64_t (*ref_difftest_memhash)(paddr_t addr, size_t n) = NULL; // optional
+void (*ref_difftest_memdirty)(uint64_t *map, size_t nr_page) = NULL; // optional
+void (*ref_difftest_mmio_inject)(paddr_t addr, int len, word_t data) = NULL; // optional
+void (*ref_difftest_exec_to)(uint64_t n, vaddr_t pc, uint64_t nr_visit) = NULL; // optional
 
 #ifdef CONFIG_DIFFTEST
 
 static bool is_skip_ref = false;
 static int skip_dut_nr_inst = 0;
 
+static void checkregs(CPU_state *ref, vaddr_t pc);
+
+#ifdef CONFIG_DIFFTEST_MODE_BATCH
+// In batch mode, REF runs behind DUT and catches up once per batch, then
+// their registers are compared. A batch ends early when REF has to see the
+// state of DUT, e.g. before an instruction skipped by REF or a DMA write.
+// On a mismatch, both sides go back to the beginning of the batch, which
+// is known to agree, and bisect the batch to find the first diverging
+// instruction.
+//
+// To go back, DUT keeps its registers at the beginning of the batch and a
+// journal of the old values of pmem written since then. REF gets the same
+// state copied from DUT.
+//
+// DUT also keeps the pcs of the batch. A REF which is slow to step, e.g.
+// KVM or QEMU, can then run freely with a breakpoint at the pc where DUT
+// ends, which DUT has executed a known number of times in the batch.
+
+typedef struct {
+  paddr_t addr;
+  int len;
+  word_t old;
+} JournalEntry;
+
+static CPU_state batch_snap = {};
+static JournalEntry *journal = NULL;
+static int nr_journal = 0, journal_cap = 0;
+static int nr_pending = 0; // instructions executed by DUT but not by REF
+static int batch_n = 1;    // adapts between 1 and CONFIG_DIFFTEST_BATCH_MAX
+static vaddr_t batch_pc[CONFIG_DIFFTEST_BATCH_MAX];
+
+void difftest_journal(paddr_t addr, int len) {
+  if (nr_journal == journal_cap) {
+    journal_cap = (journal_cap == 0 ? 1024 : journal_cap * 2);
+    journal = realloc(journal, sizeof(*journal) * journal_cap);
+    assert(journal);
+  }
+  journal[nr_journal ++] = (JournalEntry) { addr, len, host_read(guest_to_host(addr), len) };
+}
+
+static void batch_begin() {
+  batch_snap = cpu;
+  nr_journal = 0;
+  nr_pending = 0;
+}
+
+static void batch_restore() {
+  for (int i = nr_journal - 1; i >= 0; i --) {
+    host_write(guest_to_host(journal[i].addr), journal[i].len, journal[i].old);
+  }
+  for (int i = 0; i < nr_journal; i ++) {
+    ref_difftest_memcpy(journal[i].addr, guest_to_host(journal[i].addr), journal[i].len, DIFFTEST_TO_REF);
+  }
+  nr_journal = 0;
+  cpu = batch_snap;
+  ref_difftest_regcpy(&cpu, DIFFTEST_TO_REF);
+}
+
+static bool batch_regs_agree() {
+  CPU_state ref_r;
+  ref_difftest_regcpy(&ref_r, DIFFTEST_TO_DUT);
+  return memcmp(&ref_r, &cpu, DIFFTEST_REG_SIZE) == 0;
+}
+
+static void batch_bisect(int n) {
+  // after 0 instructions both sides agree, and after n they do not
+  int good = 0, bad = n;
+  while (bad - good > 1) {
+    int mid = (good + bad) / 2;
+    batch_restore();
+    cpu_exec_raw(mid);
+    ref_difftest_exec(mid);
+    if (batch_regs_agree()) good = mid;
+    else bad = mid;
+  }
+  Log("Bisect a batch of %d instructions, the first mismatch is at instruction %d", n, bad);
+
+  batch_restore();
+  cpu_exec_raw(good);
+  ref_difftest_exec(good);
+  vaddr_t pc = cpu.pc;
+  cpu_exec_raw(1);
+  ref_difftest_exec(1);
+  CPU_state ref_r;
+  ref_difftest_regcpy(&ref_r, DIFFTEST_TO_DUT);
+  if (isa_difftest_checkregs(&ref_r, pc)) {
+    Log("The mismatch can not be reproduced by replaying the batch");
+  }
+  nemu_state.state = NEMU_ABORT;
+  nemu_state.halt_pc = pc;
+  isa_reg_display();
+}
+
+// let REF catch up with DUT and compare them
+static void batch_check() {
+  if (nr_pending == 0) return;
+  int n = nr_pending;
+  if (ref_difftest_exec_to != NULL) {
+    int nr_visit = 0;
+    for (int i = 0; i < n; i ++) nr_visit += (batch_pc[i] == cpu.pc);
+    ref_difftest_exec_to(n, cpu.pc, nr_visit);
+  } else {
+    ref_difftest_exec(n);
+  }
+  if (!batch_regs_agree()) {
+    batch_bisect(n);
+    nr_pending = 0;
+    return;
+  }
+  batch_begin();
+}
+
+void difftest_sync() {
+  batch_check();
+}
+#elif defined(CONFIG_DIFFTEST_MODE_PIPELINE)
+// In pipeline mode, REF runs in a worker thread on another host core.
+// After every instruction, DUT pushes a commit record with its registers
+// into a single-producer single-consumer ring, and the worker steps REF
+// and compares with the record. When REF has to see the state of DUT,
+// e.g. for a DMA write, DUT waits for the worker to drain the ring. On a
+// mismatch the worker stops, and DUT halts at its next instruction with
+// the registers right after the diverging one.
+#include <pthread.h>
+#include <sched.h>
+
+enum { COMMIT_STEP, COMMIT_SKIP, COMMIT_MMIO };
+
+typedef struct {
+  int kind;
+  vaddr_t pc;
+  CPU_state state; // registers of DUT after the instruction
+  struct { paddr_t addr; int len; word_t data; } mmio; // an MMIO load in the instruction
+} CommitRecord;
+
+#define COMMIT_RING_LEN 4096
+static CommitRecord commit_ring[COMMIT_RING_LEN];
+static uint32_t commit_head = 0; // written by the worker
+static uint32_t commit_tail = 0; // written by DUT
+static CommitRecord *mismatch = NULL; // written by the worker
+static CPU_state mismatch_ref;
+static bool mismatch_reported = false;
+
+static void *ref_worker(void *arg) {
+  uint32_t head = 0;
+  while (true) {
+    if (head == __atomic_load_n(&commit_tail, __ATOMIC_ACQUIRE)) {
+      sched_yield();
+      continue;
+    }
+    CommitRecord *r = &commit_ring[head % COMMIT_RING_LEN];
+    if (r->kind == COMMIT_SKIP) {
+      ref_difftest_regcpy(&r->state, DIFFTEST_TO_REF);
+    } else if (r->kind == COMMIT_MMIO) {
+      ref_difftest_mmio_inject(r->mmio.addr, r->mmio.len, r->mmio.data);
+    } else {
+      ref_difftest_exec(1);
+      ref_difftest_regcpy(&mismatch_ref, DIFFTEST_TO_DUT);
+      if (memcmp(&mismatch_ref, &r->state, DIFFTEST_REG_SIZE) != 0) {
+        __atomic_store_n(&mismatch, r, __ATOMIC_RELEASE);
+        return NULL;
+      }
+    }
+    __atomic_store_n(&commit_head, ++ head, __ATOMIC_RELEASE);
+  }
+  return NULL;
+}
+
+static bool pipe_check_mismatch() {
+  CommitRecord *r = __atomic_load_n(&mismatch, __ATOMIC_ACQUIRE);
+  if (likely(r == NULL)) return false;
+  if (!mismatch_reported) {
+    mismatch_reported = true;
+    cpu = r->state;
+    isa_difftest_checkregs(&mismatch_ref, r->pc);
+    nemu_state.state = NEMU_ABORT;
+    nemu_state.halt_pc = r->pc;
+    isa_reg_display();
+  }
+  return true;
+}
+
+// return the next free record, or NULL if the worker has stopped
+static CommitRecord* pipe_alloc() {
+  uint32_t tail = commit_tail;
+  while (tail - __atomic_load_n(&commit_head, __ATOMIC_ACQUIRE) == COMMIT_RING_LEN) {
+    if (pipe_check_mismatch()) return NULL;
+    sched_yield();
+  }
+  return &commit_ring[tail % COMMIT_RING_LEN];
+}
+
+static void pipe_push(int kind, vaddr_t pc) {
+  CommitRecord *r = pipe_alloc();
+  if (r == NULL) return;
+  r->kind = kind;
+  r->pc = pc;
+  r->state = cpu;
+  __atomic_store_n(&commit_tail, commit_tail + 1, __ATOMIC_RELEASE);
+}
+
+static void pipe_push_mmio(paddr_t addr, int len, word_t data) {
+  CommitRecord *r = pipe_alloc();
+  if (r == NULL) return;
+  r->kind = COMMIT_MMIO;
+  r->mmio.addr = addr;
+  r->mmio.len = len;
+  r->mmio.data = data;
+  __atomic_store_n(&commit_tail, commit_tail + 1, __ATOMIC_RELEASE);
+}
+
+static void pipe_start() {
+  pthread_t t;
+  int ret = pthread_create(&t, NULL, ref_worker, NULL);
+  Assert(ret == 0, "Can not create the difftest worker thread");
+  pthread_detach(t);
+}
+
+// wait for the worker to check all the records
+void difftest_sync() {
+  while (__atomic_load_n(&commit_head, __ATOMIC_ACQUIRE) != commit_tail) {
+    if (pipe_check_mismatch()) return;
+    sched_yield();
+  }
+}
+#else
+void difftest_sync() { }
+#endif
+
+#ifdef CONFIG_DIFFTEST_MEMCHK
+// Every pmem write of DUT marks its page as dirty. Once per interval, the
+// dirty pages are hashed on both sides, and a page with different hashes
+// is copied from REF to find the first differing byte. A REF which logs
+// its own dirty pages adds them to the check. Otherwise a page written
+// only by REF will be missed, but it is likely to show up in a later
+// check once DUT also writes it, or to leak into a register.
+#define NR_PAGE (CONFIG_MSIZE / PAGE_SIZE)
+
+uint64_t difftest_dirty_map[(NR_PAGE + 63) / 64] = {};
+static uint64_t memchk_nr_inst = 0;
+
+static bool memchk_page(paddr_t addr) {
+  uint8_t *dut = guest_to_host(addr);
+  if (ref_difftest_memhash != NULL &&
+      ref_difftest_memhash(addr, PAGE_SIZE) == hash64(dut, PAGE_SIZE, HASH64_INIT)) return true;
+
+  static uint8_t ref[PAGE_SIZE];
+  ref_difftest_memcpy(addr, ref, PAGE_SIZE, DIFFTEST_TO_DUT);
+  for (int i = 0; i < PAGE_SIZE; i ++) {
+    if (ref[i] != dut[i]) {
+      Log("memory is different at paddr = " FMT_PADDR ", right = 0x%02x, wrong = 0x%02x",
+          (paddr_t)(addr + i), ref[i], dut[i]);
+      return false;
+    }
+  }
+  return true;
+}
+
+static void memchk(vaddr_t pc) {
+  memchk_nr_inst = 0;
+  if (nemu_state.state == NEMU_ABORT) return;
+  if (ref_difftest_memdirty != NULL) ref_difftest_memdirty(difftest_dirty_map, NR_PAGE);
+  for (int i = 0; i < ARRLEN(difftest_dirty_map); i ++) {
+    uint64_t w = difftest_dirty_map[i];
+    difftest_dirty_map[i] = 0;
+    for (; w != 0; w &= w - 1) {
+      paddr_t addr = CONFIG_MBASE + (paddr_t)(i * 64 + __builtin_ctzll(w)) * PAGE_SIZE;
+      if (!memchk_page(addr)) {
+        Log("memory check fails in the %d instructions up to pc = " FMT_WORD,
+            CONFIG_DIFFTEST_MEMCHK_INTERVAL, pc);
+        nemu_state.state = NEMU_ABORT;
+        nemu_state.halt_pc = pc;
+        return;
+      }
+    }
+  }
+}
+
+static void memchk_step(vaddr_t pc) {
+  if (++ memchk_nr_inst < CONFIG_DIFFTEST_MEMCHK_INTERVAL) return;
+  // REF has to catch up before its memory can be compared
+  difftest_sync();
+  memchk(pc);
+}
+#endif
+
 // this is used to let ref skip instructions which
 // can not produce consistent behavior with NEMU
 void difftest_skip_ref() {
+  // The skipped instruction has not written its result yet, so the state
+  // of DUT is the state before it, which REF can be compared with.
+#ifdef CONFIG_DIFFTEST_MODE_BATCH
+  batch_check();
+  // more skips are likely to come soon, e.g. in a loop accessing MMIO,
+  // so run smaller batches for a while
+  if (batch_n > 1) batch_n /= 2;
+#endif
   is_skip_ref = true;
   // If such an instruction is one of the instruction packing in QEMU
   // (see below), we end the process of catching up with QEMU's pc to
@@ -45,6 +345,24 @@ void difftest_skip_ref() {
   skip_dut_nr_inst = 0;
 }
 
+// This is called on every MMIO access of DUT. If REF supports it, the
+// value loaded by DUT is forwarded to REF, which drops MMIO stores, so
+// that the instruction is still checked. Otherwise REF skips it. Batch
+// mode always skips, since a batch may be replayed on a mismatch, which
+// would access the devices again.
+void difftest_mmio(paddr_t addr, int len, word_t data, bool is_write) {
+#ifndef CONFIG_DIFFTEST_MODE_BATCH
+  if (ref_difftest_mmio_inject != NULL) {
+    if (!is_write) {
+      MUXDEF(CONFIG_DIFFTEST_MODE_PIPELINE, pipe_push_mmio(addr, len, data),
+          ref_difftest_mmio_inject(addr, len, data));
+    }
+    return;
+  }
+#endif
+  difftest_skip_ref();
+}
+
 // this is used to deal with instruction packing in QEMU.
 // Sometimes letting QEMU step once will execute multiple instructions.
 // We should skip checking until NEMU's pc catches up with QEMU's pc.
@@ -52,6 +370,7 @@ void difftest_skip_ref() {
 //   Let REF run `nr_ref` instructions first.
 //   We expect that DUT will catch up with REF within `nr_dut` instructions.
 void difftest_skip_dut(int nr_ref, int nr_dut) {
+  difftest_sync();
   skip_dut_nr_inst += nr_dut;
 
   while (nr_ref -- > 0) {
@@ -59,6 +378,18 @@ void difftest_skip_dut(int nr_ref, int nr_dut) {
   }
 }
 
+// copy the whole state of DUT to REF, e.g. after DUT is restored from a snapshot
+void difftest_attach() {
+  difftest_sync();
+  is_skip_ref = false;
+  skip_dut_nr_inst = 0;
+  ref_difftest_memcpy(CONFIG_MBASE, guest_to_host(CONFIG_MBASE), CONFIG_MSIZE, DIFFTEST_TO_REF);
+  isa_difftest_attach();
+  ref_difftest_regcpy(&cpu, DIFFTEST_TO_REF);
+  IFDEF(CONFIG_DIFFTEST_MODE_BATCH, batch_begin());
+  IFDEF(CONFIG_DIFFTEST_MEMCHK, memset(difftest_dirty_map, 0, sizeof(difftest_dirty_map)));
+}
+
 void init_difftest(char *ref_so_file, long img_size, int port) {
   assert(ref_so_file != NULL);
 
@@ -78,6 +409,11 @@ void init_difftest(char *ref_so_file, long img_size, int port) {
   ref_difftest_raise_intr = dlsym(handle, "difftest_raise_intr");
   assert(ref_difftest_raise_intr);
 
+  ref_difftest_memhash = dlsym(handle, "difftest_memhash");
+  ref_difftest_memdirty = dlsym(handle, "difftest_memdirty");
+  ref_difftest_mmio_inject = dlsym(handle, "difftest_mmio_inject");
+  ref_difftest_exec_to = dlsym(handle, "difftest_exec_to");
+
   void (*ref_difftest_init)(int) = dlsym(handle, "difftest_init");
   assert(ref_difftest_init);
 
@@ -87,8 +423,16 @@ void init_difftest(char *ref_so_file, long img_size, int port) {
       "If it is not necessary, you can turn it off in menuconfig.", ref_so_file);
 
   ref_difftest_init(port);
+#ifdef CONFIG_DIFFTEST_MEMCHK
+  // whole pages are compared, including the bytes which the guest has not
+  // written, so they should start the same, e.g. with CONFIG_MEM_RANDOM
+  ref_difftest_memcpy(CONFIG_MBASE, guest_to_host(CONFIG_MBASE), CONFIG_MSIZE, DIFFTEST_TO_REF);
+#else
   ref_difftest_memcpy(RESET_VECTOR, guest_to_host(RESET_VECTOR), img_size, DIFFTEST_TO_REF);
+#endif
   ref_difftest_regcpy(&cpu, DIFFTEST_TO_REF);
+  IFDEF(CONFIG_DIFFTEST_MODE_BATCH, batch_begin());
+  IFDEF(CONFIG_DIFFTEST_MODE_PIPELINE, pipe_start());
 }
 
 static void checkregs(CPU_state *ref, vaddr_t pc) {
@@ -115,17 +459,37 @@ void difftest_step(vaddr_t pc, vaddr_t npc) {
     return;
   }
 
+#ifdef CONFIG_DIFFTEST_MODE_PIPELINE
+  if (pipe_check_mismatch()) return;
+  pipe_push(is_skip_ref ? COMMIT_SKIP : COMMIT_STEP, pc);
+  is_skip_ref = false;
+  IFDEF(CONFIG_DIFFTEST_MEMCHK, memchk_step(pc));
+  return;
+#endif
+
   if (is_skip_ref) {
     // to skip the checking of an instruction, just copy the reg state to reference design
     ref_difftest_regcpy(&cpu, DIFFTEST_TO_REF);
     is_skip_ref = false;
+    IFDEF(CONFIG_DIFFTEST_MODE_BATCH, batch_begin());
     return;
   }
 
+#ifdef CONFIG_DIFFTEST_MODE_BATCH
+  batch_pc[nr_pending] = pc;
+  if (++ nr_pending >= batch_n) {
+    batch_check();
+    if (batch_n < CONFIG_DIFFTEST_BATCH_MAX) batch_n *= 2;
+  }
+  IFDEF(CONFIG_DIFFTEST_MEMCHK, memchk_step(pc));
+  return;
+#endif
+
   ref_difftest_exec(1);
   ref_difftest_regcpy(&ref_r, DIFFTEST_TO_DUT);
 
   checkregs(&ref_r, pc);
+  IFDEF(CONFIG_DIFFTEST_MEMCHK, memchk_step(pc));
 }
 #else
 void init_difftest(char *ref_so_file, long img_size, int port) { }
@@ -15,26 +15,88 @@
 
 #include <isa.h>
 #include <cpu/cpu.h>
+#include <cpu/difftest.h>
 #include <difftest-def.h>
 #include <memory/paddr.h>
 
 __EXPORT void difftest_memcpy(paddr_t addr, void *buf, size_t n, bool direction) {
-  assert(0);
+  if (direction == DIFFTEST_TO_REF) memcpy(guest_to_host(addr), buf, n);
+  else memcpy(buf, guest_to_host(addr), n);
+}
+
+// The MMIO loads of DUT, in the order of execution. REF has no devices,
+// so its MMIO loads take these values, and its MMIO stores are dropped.
+#define MMIO_QUEUE_LEN 64
+
+static struct {
+  paddr_t addr;
+  int len;
+  word_t data;
+} mmio_queue[MMIO_QUEUE_LEN];
+static uint32_t mmio_head = 0, mmio_tail = 0;
+
+__EXPORT void difftest_mmio_inject(paddr_t addr, int len, word_t data) {
+  Assert(mmio_tail - mmio_head < MMIO_QUEUE_LEN, "too many MMIO loads are injected without being executed");
+  int i = mmio_tail ++ % MMIO_QUEUE_LEN;
+  mmio_queue[i].addr = addr;
+  mmio_queue[i].len = len;
+  mmio_queue[i].data = data;
+}
+
+word_t difftest_mmio_read(paddr_t addr, int len) {
+  if (mmio_head == mmio_tail) {
+    Log("REF loads from address = " FMT_PADDR " at pc = " FMT_WORD ", but DUT does not", addr, cpu.pc);
+    return 0;
+  }
+  int i = mmio_head ++ % MMIO_QUEUE_LEN;
+  if (mmio_queue[i].addr != addr || mmio_queue[i].len != len) {
+    Log("REF loads %d bytes from address = " FMT_PADDR " at pc = " FMT_WORD
+        ", but DUT loads %d bytes from address = " FMT_PADDR,
+        len, addr, cpu.pc, mmio_queue[i].len, mmio_queue[i].addr);
+  }
+  return mmio_queue[i].data;
+}
+
+static void mmio_queue_drop(bool warn) {
+  if (warn && mmio_head != mmio_tail) {
+    int i = mmio_head % MMIO_QUEUE_LEN;
+    Log("DUT loads from address = " FMT_PADDR " at pc = " FMT_WORD ", but REF does not",
+        mmio_queue[i].addr, cpu.pc);
+  }
+  mmio_head = mmio_tail;
 }
 
 __EXPORT void difftest_regcpy(void *dut, bool direction) {
-  assert(0);
+  if (direction == DIFFTEST_TO_REF) {
+    memcpy(&cpu, dut, DIFFTEST_REG_SIZE);
+    // DUT resynchronizes REF, e.g. to skip an instruction, and the loads
+    // injected for the skipped instruction will never be executed by REF
+    mmio_queue_drop(false);
+  } else {
+    memcpy(dut, &cpu, DIFFTEST_REG_SIZE);
+  }
 }
 
+// run the instructions without tracing, difftest and devices
 __EXPORT void difftest_exec(uint64_t n) {
-  assert(0);
+  while (n --) {
+    cpu_exec_raw(1);
+    // a load of DUT which is not executed by REF should not be taken by
+    // the next instruction
+    mmio_queue_drop(true);
+  }
 }
 
 __EXPORT void difftest_raise_intr(word_t NO) {
-  assert(0);
+  cpu.pc = isa_raise_intr(NO, cpu.pc);
+}
+
+__EXPORT uint64_t difftest_memhash(paddr_t addr, size_t n) {
+  return hash64(guest_to_host(addr), n, HASH64_INIT);
 }
 
 __EXPORT void difftest_init(int port) {
+  mmio_queue_drop(false);
   void init_mem();
   init_mem();
   /* Perform ISA dependent initialization. */
@@ -0,0 +1,164 @@
+/***************************************************************************************
+* Copyright (c) 2014-2024 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+#include <isa.h>
+#include <cpu/cpu.h>
+#include <cpu/difftest.h>
+#include <memory/vaddr.h>
+#include <device/map.h>
+#include <elf.h>
+
+// High-level emulation of well-known guest functions. When the guest jumps
+// to the entry of a hooked function, the function is run on the host and
+// the guest continues at its return address, as if it had executed the
+// whole function. Entries are found by name in the symbol table of the ELF.
+
+#define ARG(i) (cpu.gpr[10 + (i)]) // a0-a7
+#define RA     (cpu.gpr[1])
+
+#define Elf_Ehdr MUXDEF(CONFIG_ISA64, Elf64_Ehdr, Elf32_Ehdr)
+#define Elf_Shdr MUXDEF(CONFIG_ISA64, Elf64_Shdr, Elf32_Shdr)
+#define Elf_Sym  MUXDEF(CONFIG_ISA64, Elf64_Sym , Elf32_Sym )
+#define ELF_ST_TYPE MUXDEF(CONFIG_ISA64, ELF64_ST_TYPE, ELF32_ST_TYPE)
+
+// Each hook returns false if it can not handle the call, e.g. when a buffer
+// is not in pmem but MMIO, then the guest function is executed as usual.
+typedef bool (*hle_fn_t)();
+
+static uint8_t* guest_buf(vaddr_t addr, word_t len) {
+  if (isa_mmu_check(addr, 1, MEM_TYPE_READ) != MMU_DIRECT) return NULL;
+  return dma_guest_ptr(addr, len);
+}
+
+static bool hle_memcpy() {
+  uint8_t *dst = guest_buf(ARG(0), ARG(2));
+  uint8_t *src = guest_buf(ARG(1), ARG(2));
+  if (dst == NULL || src == NULL) return false;
+  memmove(dst, src, ARG(2));
+  dma_guest_written(ARG(0), ARG(2));
+  return true; // returns dst, which is already in a0
+}
+
+static bool hle_memset() {
+  uint8_t *s = guest_buf(ARG(0), ARG(2));
+  if (s == NULL) return false;
+  memset(s, ARG(1), ARG(2));
+  dma_guest_written(ARG(0), ARG(2));
+  return true;
+}
+
+static bool hle_strlen() {
+  uint8_t *s = guest_buf(ARG(0), 1);
+  if (s == NULL) return false;
+  size_t max = CONFIG_MBASE + CONFIG_MSIZE - ARG(0);
+  uint8_t *end = memchr(s, '\0', max);
+  if (end == NULL) return false;
+  ARG(0) = end - s;
+  return true;
+}
+
+static bool hle_memcmp() {
+  uint8_t *s1 = guest_buf(ARG(0), ARG(2));
+  uint8_t *s2 = guest_buf(ARG(1), ARG(2));
+  if (s1 == NULL || s2 == NULL) return false;
+  word_t n = ARG(2), i;
+  for (i = 0; i < n && s1[i] == s2[i]; i ++);
+  ARG(0) = (i == n ? 0 : (sword_t)s1[i] - s2[i]);
+  return true;
+}
+
+static struct {
+  const char *name;
+  hle_fn_t fn;
+  vaddr_t entry;
+  uint64_t nr_call;
+} hooks[] = {
+  { "memcpy", hle_memcpy },
+  { "memset", hle_memset },
+  { "strlen", hle_strlen },
+  { "memcmp", hle_memcmp },
+};
+
+#define NR_HOOK ARRLEN(hooks)
+
+// all entries are inside [lo, hi], which filters out most pcs quickly
+static vaddr_t lo = -1, hi = 0;
+
+// return the name of the function if it is run on the host, or NULL
+const char* hle_try_call(vaddr_t pc) {
+  if (pc < lo || pc > hi) return NULL;
+  for (int i = 0; i < NR_HOOK; i ++) {
+    if (hooks[i].entry == pc && hooks[i].entry != 0) {
+      // a pending check of the reference should see the registers before
+      // the hook changes them
+      difftest_sync();
+      if (!hooks[i].fn()) return NULL;
+      // the reference does not run the function, take the registers from
+      // NEMU, but only if the hook is run, otherwise the skip would leak
+      // onto the next real instruction
+      difftest_skip_ref();
+      hooks[i].nr_call ++;
+      cpu.pc = RA;
+      return hooks[i].name;
+    }
+  }
+  return NULL;
+}
+
+void hle_statistic() {
+  for (int i = 0; i < NR_HOOK; i ++) {
+    if (hooks[i].entry != 0) {
+      Log("HLE: %s is called %" PRIu64 " times", hooks[i].name, hooks[i].nr_call);
+    }
+  }
+}
+
+void init_hle(const char *elf_file) {
+  if (elf_file == NULL) return;
+
+  FILE *fp = fopen(elf_file, "rb");
+  Assert(fp, "Can not open '%s'", elf_file);
+  fseek(fp, 0, SEEK_END);
+  long size = ftell(fp);
+  uint8_t *buf = malloc(size);
+  fseek(fp, 0, SEEK_SET);
+  int ret = fread(buf, size, 1, fp);
+  assert(ret == 1);
+  fclose(fp);
+
+  Elf_Ehdr *eh = (Elf_Ehdr *)buf;
+  Assert(size >= sizeof(*eh) && memcmp(eh->e_ident, ELFMAG, SELFMAG) == 0 &&
+      eh->e_ident[EI_CLASS] == MUXDEF(CONFIG_ISA64, ELFCLASS64, ELFCLASS32),
+      "'%s' is not an ELF file of the guest", elf_file);
+  Elf_Shdr *sh = (Elf_Shdr *)(buf + eh->e_shoff);
+  for (int i = 0; i < eh->e_shnum; i ++) {
+    if (sh[i].sh_type != SHT_SYMTAB) continue;
+    Elf_Sym *sym = (Elf_Sym *)(buf + sh[i].sh_offset);
+    const char *strtab = (const char *)(buf + sh[sh[i].sh_link].sh_offset);
+    int nr_sym = sh[i].sh_size / sizeof(Elf_Sym);
+    for (int j = 0; j < nr_sym; j ++) {
+      if (ELF_ST_TYPE(sym[j].st_info) != STT_FUNC || sym[j].st_value == 0) continue;
+      for (int k = 0; k < NR_HOOK; k ++) {
+        if (strcmp(strtab + sym[j].st_name, hooks[k].name) == 0) {
+          hooks[k].entry = sym[j].st_value;
+          if (hooks[k].entry < lo) lo = hooks[k].entry;
+          if (hooks[k].entry > hi) hi = hooks[k].entry;
+          Log("HLE: hook %s at " FMT_WORD, hooks[k].name, hooks[k].entry);
+        }
+      }
+    }
+  }
+  free(buf);
+}
@@ -14,6 +14,7 @@
 ***************************************************************************************/
 
 #include <common.h>
+#include <utils.h>
 #include <device/map.h>
 #include <SDL2/SDL.h>
 
@@ -30,12 +31,198 @@ enum {
 static uint8_t *sbuf = NULL;
 static uint32_t *audio_base = NULL;
 
+// `sbuf` is a single-producer/single-consumer ring. The guest is the producer:
+// it fills the ring after its own write pointer, then writes the number of
+// bytes it has just filled to `reg_count`. The SDL audio thread is the
+// consumer. `count` is the only variable shared by the two threads, so the
+// CPU thread never takes a lock or waits for the audio thread.
+static uint32_t count = 0;
+static uint32_t head = 0; // owned by the consumer
+
+static uint32_t audio_consume(uint8_t *stream, int len) {
+  uint32_t nr_avail = __atomic_load_n(&count, __ATOMIC_ACQUIRE);
+  uint32_t n = ((uint32_t)len < nr_avail ? len : nr_avail);
+  uint32_t n1 = CONFIG_SB_SIZE - head;
+  if (n <= n1) {
+    memcpy(stream, sbuf + head, n);
+  } else {
+    memcpy(stream, sbuf + head, n1);
+    memcpy(stream + n1, sbuf, n - n1);
+  }
+  head = (head + n) % CONFIG_SB_SIZE;
+  __atomic_fetch_sub(&count, n, __ATOMIC_RELEASE);
+  return n;
+}
+
+// the guest starts again from the beginning of `sbuf` after it initializes
+// the device, this should only be called when the consumer is stopped
+static void audio_reset_ring() {
+  head = 0;
+  __atomic_store_n(&count, 0, __ATOMIC_RELEASE);
+}
+
+static void audio_play(void *userdata, uint8_t *stream, int len) {
+  uint32_t n = audio_consume(stream, len);
+  // underrun, play silence
+  if (n < (uint32_t)len) memset(stream + n, 0, len - n);
+}
+
+// Headless sink which streams the samples to a WAV file instead of SDL.
+// With `wav`, samples are consumed as soon as the guest commits them, so
+// the guest runs as fast as it can. With `wav-rt`, samples are consumed at
+// the playback rate in `audio_update()`, like a real sound card. Underruns
+// are not filled with silence, so the file only depends on the guest output.
+enum { CAPTURE_NONE, CAPTURE_WAV, CAPTURE_WAV_RT };
+static int capture_mode = CAPTURE_NONE;
+static FILE *wav_fp = NULL;
+static bool wav_started = false;
+static uint64_t wav_size = 0;
+static uint64_t rt_start = 0;
+static uint64_t rt_pos = 0;
+static uint32_t wav_freq = 0, wav_channels = 0;
+
+void audio_set_capture(const char *spec) {
+  const char *colon = strchr(spec, ':');
+  Assert(colon != NULL && colon[1] != '\0', "Invalid audio capture '%s', expect MODE:FILE", spec);
+  int n = colon - spec;
+  if (n == 3 && strncmp(spec, "wav", n) == 0) capture_mode = CAPTURE_WAV;
+  else if (n == 6 && strncmp(spec, "wav-rt", n) == 0) capture_mode = CAPTURE_WAV_RT;
+  else panic("Unknown audio capture mode '%.*s', expect wav or wav-rt", n, spec);
+
+  wav_fp = fopen(colon + 1, "wb");
+  Assert(wav_fp, "Can not open '%s'", colon + 1);
+  setvbuf(wav_fp, NULL, _IOFBF, 1 << 20);
+}
+
+static void wav_write_header() {
+  uint32_t freq = wav_freq;
+  uint16_t channels = wav_channels;
+  uint32_t riff_size = wav_size + 36;
+  uint32_t data_size = wav_size;
+  uint32_t fmt_size = 16;
+  uint16_t fmt_pcm = 1;
+  uint16_t bits = 16;
+  uint16_t block_align = channels * bits / 8;
+  uint32_t byte_rate = freq * block_align;
+  uint8_t h[44], *p = h;
+#define put(x) do { memcpy(p, &x, sizeof(x)); p += sizeof(x); } while (0)
+  memcpy(p, "RIFF", 4); p += 4; put(riff_size);
+  memcpy(p, "WAVEfmt ", 8); p += 8; put(fmt_size);
+  put(fmt_pcm); put(channels); put(freq); put(byte_rate); put(block_align); put(bits);
+  memcpy(p, "data", 4); p += 4; put(data_size);
+#undef put
+  fseek(wav_fp, 0, SEEK_SET);
+  fwrite(h, sizeof(h), 1, wav_fp);
+}
+
+static void wav_drain(uint32_t max) {
+  static uint8_t buf[CONFIG_SB_SIZE];
+  while (max > 0) {
+    uint32_t n = audio_consume(buf, max < sizeof(buf) ? max : sizeof(buf));
+    if (n == 0) break;
+    fwrite(buf, n, 1, wav_fp);
+    wav_size += n;
+    max -= n;
+  }
+}
+
+static void wav_close() {
+  wav_drain(UINT32_MAX);
+  uint64_t us = get_time() - rt_start;
+  wav_write_header();
+  fclose(wav_fp);
+  uint32_t byte_rate = wav_freq * wav_channels * 2;
+  Log("Audio: %" PRIu64 " bytes (%.2lf s) captured in %.2lf s",
+      wav_size, byte_rate ? (double)wav_size / byte_rate : 0.0, us / 1000000.0);
+}
+
+void audio_update() {
+  if (capture_mode != CAPTURE_WAV_RT || !wav_started) return;
+  uint32_t byte_rate = wav_freq * wav_channels * 2;
+  uint64_t due = (get_time() - rt_start) * byte_rate / 1000000;
+  // keep the frame alignment of the stream
+  due -= due % (wav_channels * 2);
+  wav_drain(due - rt_pos);
+  // what is not ready yet is skipped, as a real sound card does
+  rt_pos = due;
+}
+
+// The file has a single format, so a later initialization only drops the
+// samples not captured yet, and keeps the format of the first one.
+static void audio_init_wav() {
+  if (wav_started) {
+    wav_drain(UINT32_MAX);
+    audio_reset_ring();
+    if (audio_base[reg_freq] != wav_freq || audio_base[reg_channels] != wav_channels) {
+      Log("Audio: the format changes to %d Hz, %d channels, but the capture keeps %d Hz, %d channels",
+          audio_base[reg_freq], audio_base[reg_channels], wav_freq, wav_channels);
+    }
+    return;
+  }
+  Assert(audio_base[reg_channels] > 0, "Invalid number of channels");
+  wav_freq = audio_base[reg_freq];
+  wav_channels = audio_base[reg_channels];
+  wav_write_header();
+  rt_start = get_time();
+  wav_started = true;
+  atexit(wav_close);
+}
+
+// A later initialization with the same format only resets the ring,
+// otherwise the device is closed and opened again with the new format.
+static void audio_init_sdl() {
+  static bool opened = false;
+  static SDL_AudioSpec cur = {};
+  SDL_AudioSpec s = {};
+  s.format = AUDIO_S16SYS;
+  s.userdata = NULL;
+  s.freq = audio_base[reg_freq];
+  s.channels = audio_base[reg_channels];
+  s.samples = audio_base[reg_samples];
+  s.callback = audio_play;
+  if (opened && s.freq == cur.freq && s.channels == cur.channels && s.samples == cur.samples) {
+    SDL_LockAudio();
+    audio_reset_ring();
+    SDL_UnlockAudio();
+    return;
+  }
+  if (opened) SDL_CloseAudio();
+  else SDL_InitSubSystem(SDL_INIT_AUDIO);
+  audio_reset_ring();
+  int ret = SDL_OpenAudio(&s, NULL);
+  Assert(ret == 0, "Can not open audio device: %s", SDL_GetError());
+  opened = true;
+  cur = s;
+  SDL_PauseAudio(0);
+}
+
 static void audio_io_handler(uint32_t offset, int len, bool is_write) {
+  switch (offset / sizeof(uint32_t)) {
+    case reg_init:
+      if (is_write && audio_base[reg_init]) {
+        if (capture_mode == CAPTURE_NONE) audio_init_sdl();
+        else audio_init_wav();
+        audio_base[reg_init] = 0;
+      }
+      break;
+    case reg_count:
+      if (is_write) {
+        // the consumer only makes more room, so this never overfills `sbuf`
+        uint32_t nr_free = CONFIG_SB_SIZE - __atomic_load_n(&count, __ATOMIC_ACQUIRE);
+        uint32_t n = (audio_base[reg_count] < nr_free ? audio_base[reg_count] : nr_free);
+        // make the samples written to `sbuf` visible before the new count
+        __atomic_fetch_add(&count, n, __ATOMIC_RELEASE);
+        if (capture_mode == CAPTURE_WAV && wav_started) wav_drain(UINT32_MAX);
+      }
+      audio_base[reg_count] = __atomic_load_n(&count, __ATOMIC_ACQUIRE);
+      break;
+  }
 }
 
 void init_audio() {
   uint32_t space_size = sizeof(uint32_t) * nr_reg;
   audio_base = (uint32_t *)new_space(space_size);
+  audio_base[reg_sbuf_size] = CONFIG_SB_SIZE;
 #ifdef CONFIG_HAS_PORT_IO
   add_pio_map ("audio", CONFIG_AUDIO_CTL_PORT, audio_base, space_size, audio_io_handler);
 #else
@@ -44,4 +231,7 @@ void init_audio() {
 
   sbuf = (uint8_t *)new_space(CONFIG_SB_SIZE);
   add_mmio_map("audio-sbuf", CONFIG_SB_ADDR, sbuf, CONFIG_SB_SIZE, NULL);
+  // `sbuf` is saved with the I/O space, the ring pointers should match it
+  add_snapshot_state("sb_count", &count, sizeof(count));
+  add_snapshot_state("sb_head", &head, sizeof(head));
 }
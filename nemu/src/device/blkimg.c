@@ -0,0 +1,175 @@
+/***************************************************************************************
+* Copyright (c) 2014-2024 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+#include <device/blkimg.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+// Layout of the overlay file:
+//   [0, 4KB)          header
+//   [4KB, data_off)   allocation bitmap, one bit for each block
+//   [data_off, ...)   blocks, at the same offsets as in the image
+// The file is created sparse, so only the written blocks take disk space.
+// Reads of unallocated blocks go to the mapping of the image, which is
+// shared by the page cache of all runs using the same image.
+
+#define OVL_BLKSZ 512
+#define OVL_MAGIC "NEMUOVL1"
+#define OVL_HDR_SIZE 4096
+
+typedef struct {
+  char magic[8];
+  uint64_t img_size;
+  uint64_t blksz;
+  uint64_t data_off;
+} OvlHeader;
+
+struct BlkImg {
+  uint8_t *base;
+  uint64_t size;
+  uint8_t *bitmap; // NULL without an overlay
+  uint8_t *data;
+};
+
+static uint8_t* map_file(int fd, uint64_t size, bool writable) {
+  if (size == 0) return NULL;
+  void *p = mmap(NULL, size, PROT_READ | (writable ? PROT_WRITE : 0), MAP_SHARED, fd, 0);
+  Assert(p != MAP_FAILED, "mmap() failed: %s", strerror(errno));
+  return p;
+}
+
+static void open_overlay(BlkImg *img, const char *overlay) {
+  uint64_t nr_blk = (img->size + OVL_BLKSZ - 1) / OVL_BLKSZ;
+  uint64_t data_off = OVL_HDR_SIZE + ROUNDUP((nr_blk + 7) / 8, OVL_HDR_SIZE);
+  uint64_t ovl_size = data_off + img->size;
+
+  int fd = open(overlay, O_RDWR | O_CREAT, 0644);
+  Assert(fd >= 0, "Can not open '%s'", overlay);
+  struct stat st;
+  int ret = fstat(fd, &st);
+  assert(ret == 0);
+  bool is_new = (st.st_size == 0);
+  if (is_new) {
+    ret = ftruncate(fd, ovl_size);
+    Assert(ret == 0, "Can not resize '%s'", overlay);
+  } else {
+    // accessing the mapping beyond the end of a truncated file raises SIGBUS
+    Assert((uint64_t)st.st_size >= ovl_size, "Overlay '%s' is truncated (%" PRIu64 " bytes, expect %" PRIu64 ")",
+        overlay, (uint64_t)st.st_size, ovl_size);
+  }
+
+  uint8_t *p = map_file(fd, ovl_size, true);
+  close(fd);
+  OvlHeader *hdr = (OvlHeader *)p;
+  if (is_new) {
+    memcpy(hdr->magic, OVL_MAGIC, sizeof(hdr->magic));
+    hdr->img_size = img->size;
+    hdr->blksz = OVL_BLKSZ;
+    hdr->data_off = data_off;
+  } else {
+    Assert(memcmp(hdr->magic, OVL_MAGIC, sizeof(hdr->magic)) == 0, "'%s' is not an overlay", overlay);
+    Assert(hdr->img_size == img->size && hdr->blksz == OVL_BLKSZ && hdr->data_off == data_off,
+        "Overlay '%s' does not match the image", overlay);
+  }
+  img->bitmap = p + OVL_HDR_SIZE;
+  img->data = p + data_off;
+}
+
+BlkImg* blkimg_open(const char *path, const char *overlay) {
+  BlkImg *img = malloc(sizeof(*img));
+  assert(img);
+  int fd = open(path, overlay ? O_RDONLY : O_RDWR);
+  Assert(fd >= 0, "Can not open '%s'", path);
+  struct stat st;
+  int ret = fstat(fd, &st);
+  assert(ret == 0);
+  img->size = st.st_size;
+  img->base = map_file(fd, img->size, overlay == NULL);
+  close(fd);
+  img->bitmap = img->data = NULL;
+  if (overlay != NULL) {
+    open_overlay(img, overlay);
+    Log("Image %s with overlay %s", path, overlay);
+  }
+  return img;
+}
+
+uint64_t blkimg_size(BlkImg *img) {
+  return img->size;
+}
+
+static inline bool blk_in_overlay(BlkImg *img, uint64_t blk) {
+  return (img->bitmap[blk / 8] >> (blk % 8)) & 1;
+}
+
+static inline void clip(BlkImg *img, uint64_t off, size_t *len) {
+  if (off >= img->size) *len = 0;
+  else if (*len > img->size - off) *len = img->size - off;
+}
+
+void blkimg_read(BlkImg *img, uint64_t off, void *buf, size_t len) {
+  size_t n = len;
+  clip(img, off, &n);
+  // bytes beyond the end of the image read as zero
+  memset((uint8_t *)buf + n, 0, len - n);
+  if (img->bitmap == NULL) {
+    memcpy(buf, img->base + off, n);
+    return;
+  }
+
+  // copy runs of blocks which come from the same file at once
+  uint8_t *dst = buf;
+  while (n > 0) {
+    uint64_t blk = off / OVL_BLKSZ;
+    uint64_t last = (off + n - 1) / OVL_BLKSZ;
+    bool in_ovl = blk_in_overlay(img, blk);
+    uint64_t end = blk + 1;
+    while (end <= last && blk_in_overlay(img, end) == in_ovl) end ++;
+    size_t run = end * OVL_BLKSZ - off;
+    if (run > n) run = n;
+    memcpy(dst, (in_ovl ? img->data : img->base) + off, run);
+    dst += run; off += run; n -= run;
+  }
+}
+
+void blkimg_write(BlkImg *img, uint64_t off, const void *buf, size_t len) {
+  // writes beyond the end of the image are dropped
+  clip(img, off, &len);
+  if (img->bitmap == NULL) {
+    memcpy(img->base + off, buf, len);
+    return;
+  }
+
+  const uint8_t *src = buf;
+  while (len > 0) {
+    uint64_t blk = off / OVL_BLKSZ;
+    uint64_t blk_off = off % OVL_BLKSZ;
+    size_t n = OVL_BLKSZ - blk_off;
+    if (n > len) n = len;
+    if (!blk_in_overlay(img, blk)) {
+      // copy-on-write: a partially written block should keep the other bytes
+      if (n != OVL_BLKSZ) {
+        uint64_t start = blk * OVL_BLKSZ;
+        uint64_t blk_len = (img->size - start < OVL_BLKSZ ? img->size - start : OVL_BLKSZ);
+        memcpy(img->data + start, img->base + start, blk_len);
+      }
+      img->bitmap[blk / 8] |= 1 << (blk % 8);
+    }
+    memcpy(img->data + off, src, n);
+    src += n; off += n; len -= n;
+  }
+}
@@ -28,22 +28,44 @@ void init_i8042();
 void init_audio();
 void init_disk();
 void init_sdcard();
+void init_net();
 void init_alarm();
+void init_device_thread();
 
 void send_key(uint8_t, bool);
 void vga_update_screen();
+void audio_update();
+void serial_update();
+void net_update();
+void pvclock_tick();
+void device_thread_update();
+void device_thread_clear_events();
+
+static uint64_t last_update = 0;
+
+// time in us until device_update() refreshes the devices again
+uint64_t device_next_event() {
+  uint64_t elapsed = get_time() - last_update;
+  return elapsed < 1000000 / TIMER_HZ ? 1000000 / TIMER_HZ - elapsed : 0;
+}
 
 void device_update() {
-  static uint64_t last = 0;
+  IFDEF(CONFIG_HAS_PVCLOCK, pvclock_tick());
+
   uint64_t now = get_time();
-  if (now - last < 1000000 / TIMER_HZ) {
+  if (now - last_update < 1000000 / TIMER_HZ) {
     return;
   }
-  last = now;
+  last_update = now;
 
   IFDEF(CONFIG_HAS_VGA, vga_update_screen());
+  IFDEF(CONFIG_HAS_AUDIO, audio_update());
+  IFDEF(CONFIG_HAS_SERIAL, serial_update());
+  IFDEF(CONFIG_HAS_NET, net_update());
 
-#ifndef CONFIG_TARGET_AM
+#if defined(CONFIG_DEVICE_THREAD)
+  device_thread_update();
+#elif !defined(CONFIG_TARGET_AM)
   SDL_Event event;
   while (SDL_PollEvent(&event)) {
     switch (event.type) {
@@ -67,7 +89,9 @@ void device_update() {
 }
 
 void sdl_clear_event_queue() {
-#ifndef CONFIG_TARGET_AM
+#if defined(CONFIG_DEVICE_THREAD)
+  device_thread_clear_events();
+#elif !defined(CONFIG_TARGET_AM)
   SDL_Event event;
   while (SDL_PollEvent(&event));
 #endif
@@ -84,6 +108,8 @@ void init_device() {
   IFDEF(CONFIG_HAS_AUDIO, init_audio());
   IFDEF(CONFIG_HAS_DISK, init_disk());
   IFDEF(CONFIG_HAS_SDCARD, init_sdcard());
+  IFDEF(CONFIG_HAS_NET, init_net());
 
+  IFDEF(CONFIG_DEVICE_THREAD, init_device_thread());
   IFNDEF(CONFIG_TARGET_AM, init_alarm());
 }
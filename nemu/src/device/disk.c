@@ -14,6 +14,93 @@
 ***************************************************************************************/
 
 #include <device/map.h>
+#include <device/blkimg.h>
+
+// A block device with DMA. The guest sets up `blkno`, `count` and `buf`,
+// then writes `cmd` to start the transfer. The whole request is served at
+// once by copying between the mapped image and pmem, and is finished when
+// the write to `cmd` returns. If `intr` is non-zero, an interrupt is raised
+// on completion.
+// A transfer never outlives the write to `cmd`, so the registers, which
+// snapshots save with the I/O space, are the whole state of the controller.
+
+#define BLKSZ 512
+
+enum {
+  reg_blksz,   // RO, size of a block in bytes
+  reg_blkcnt,  // RO, number of blocks in the image
+  reg_blkno,   // the first block to transfer
+  reg_count,   // number of blocks to transfer
+  reg_buf,     // physical address of the buffer in pmem
+  reg_cmd,     // writing DISK_CMD_* starts a transfer
+  reg_status,  // RO, DISK_OK or the error of the last transfer
+  reg_intr,    // raise an interrupt on completion if non-zero
+  nr_reg
+};
+
+enum { DISK_CMD_READ = 1, DISK_CMD_WRITE = 2 };
+enum { DISK_OK, DISK_ERR_CMD, DISK_ERR_RANGE, DISK_ERR_BUF };
+
+static uint32_t *disk_base = NULL;
+static BlkImg *img = NULL;
+static uint64_t img_blkcnt = 0;
+static const char *overlay = NULL;
+
+void disk_set_overlay(const char *file) {
+  overlay = file;
+}
+
+static int disk_transfer(int cmd) {
+  if (cmd != DISK_CMD_READ && cmd != DISK_CMD_WRITE) return DISK_ERR_CMD;
+  uint64_t blkno = disk_base[reg_blkno];
+  uint64_t count = disk_base[reg_count];
+  if (img == NULL || blkno + count > img_blkcnt) return DISK_ERR_RANGE;
+  if (count == 0) return DISK_OK;
+  paddr_t buf = disk_base[reg_buf];
+  size_t len = count * BLKSZ;
+  uint8_t *p = dma_guest_ptr(buf, len);
+  if (p == NULL) return DISK_ERR_BUF;
+
+  if (cmd == DISK_CMD_READ) {
+    blkimg_read(img, blkno * BLKSZ, p, len);
+    dma_guest_written(buf, len);
+  } else {
+    blkimg_write(img, blkno * BLKSZ, p, len);
+  }
+  return DISK_OK;
+}
+
+static void disk_io_handler(uint32_t offset, int len, bool is_write) {
+  if (is_write && offset == reg_cmd * sizeof(uint32_t)) {
+    disk_base[reg_status] = disk_transfer(disk_base[reg_cmd]);
+    disk_base[reg_cmd] = 0;
+    if (disk_base[reg_intr]) {
+      extern void dev_raise_intr();
+      dev_raise_intr();
+    }
+  }
+}
+
+static void init_img(const char *path) {
+  if (path[0] == '\0') {
+    Log("No disk image is given, the disk is empty");
+    return;
+  }
+  img = blkimg_open(path, overlay);
+  img_blkcnt = blkimg_size(img) / BLKSZ;
+  Log("Disk image %s, %" PRIu64 " blocks", path, img_blkcnt);
+}
 
 void init_disk() {
+  uint32_t space_size = sizeof(uint32_t) * nr_reg;
+  disk_base = (uint32_t *)new_space(space_size);
+#ifdef CONFIG_HAS_PORT_IO
+  add_pio_map ("disk", CONFIG_DISK_CTL_PORT, disk_base, space_size, disk_io_handler);
+#else
+  add_mmio_map("disk", CONFIG_DISK_CTL_MMIO, disk_base, space_size, disk_io_handler);
+#endif
+
+  init_img(CONFIG_DISK_IMG_PATH);
+  disk_base[reg_blksz] = BLKSZ;
+  disk_base[reg_blkcnt] = img_blkcnt;
 }
@@ -22,11 +22,16 @@ SRCS-$(CONFIG_HAS_VGA) += src/device/vga.c
 SRCS-$(CONFIG_HAS_AUDIO) += src/device/audio.c
 SRCS-$(CONFIG_HAS_DISK) += src/device/disk.c
 SRCS-$(CONFIG_HAS_SDCARD) += src/device/sdcard.c
+SRCS-$(CONFIG_HAS_NET) += src/device/net.c
+SRCS-$(CONFIG_BLKIMG) += src/device/blkimg.c
+SRCS-$(CONFIG_DEVICE_THREAD) += src/device/thread.c
+SRCS-$(CONFIG_IDLE_DETECT) += src/device/idle.c
 
 SRCS-BLACKLIST-$(CONFIG_TARGET_AM) += src/device/alarm.c
 
 ifdef CONFIG_DEVICE
 ifndef CONFIG_TARGET_AM
 LIBS += $(shell sdl2-config --libs)
+LIBS += $(if $(CONFIG_DEVICE_THREAD),-lpthread,)
 endif
 endif
@@ -0,0 +1,125 @@
+/***************************************************************************************
+* Copyright (c) 2014-2024 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+#include <isa.h>
+#include <utils.h>
+#include <device/idle.h>
+#include <device/alarm.h>
+#include <unistd.h>
+
+// A polling loop is detected when the guest polls a device from the same
+// pc several times in a row, with only a few instructions and no stores in
+// between, except those to its own stack frame. Instead of emulating the
+// rest of the loop, NEMU either sleeps or warps the guest clock forward.
+// The first skip of a loop is short, so that a short wait does not
+// overshoot much, and every further skip of the same loop doubles, up to
+// the next time the devices are updated.
+
+#define IDLE_SPIN_THRESHOLD 16
+#define IDLE_LOOP_MAX_INST  64
+#define IDLE_FRAME_SIZE     256
+#define IDLE_MIN_SKIP_US    100
+
+enum { IDLE_OFF, IDLE_SLEEP, IDLE_WARP };
+static int idle_mode = IDLE_SLEEP;
+
+uint32_t idle_nr_spin = 0;
+uint64_t idle_time_offset = 0;
+static vaddr_t last_pc = 0;
+static uint64_t last_inst = 0;
+static uint64_t skip_us = IDLE_MIN_SKIP_US;
+static uint64_t nr_skip = 0, sleep_us = 0;
+
+void device_update();
+uint64_t device_next_event();
+void pvclock_update();
+
+static word_t guest_sp() {
+#if defined(CONFIG_ISA_riscv)
+  return cpu.gpr[2];
+#elif defined(CONFIG_ISA_mips32)
+  return cpu.gpr[29];
+#elif defined(CONFIG_ISA_loongarch32r)
+  return cpu.gpr[3];
+#else
+  return cpu.esp;
+#endif
+}
+
+static void idle_reset() {
+  idle_nr_spin = 0;
+  skip_us = IDLE_MIN_SKIP_US;
+}
+
+void idle_set_mode(const char *mode) {
+  if (strcmp(mode, "off") == 0) idle_mode = IDLE_OFF;
+  else if (strcmp(mode, "sleep") == 0) idle_mode = IDLE_SLEEP;
+  else if (strcmp(mode, "warp") == 0) idle_mode = IDLE_WARP;
+  else panic("Unknown idle mode '%s', expect off, sleep or warp", mode);
+}
+
+static void idle_skip(int wait, uint64_t us) {
+  nr_skip ++;
+  // input comes from the outside world, only a timer can be warped
+  if (idle_mode == IDLE_WARP && wait == IDLE_WAIT_TIMER) {
+    idle_time_offset += us;
+  } else {
+    usleep(us);
+    sleep_us += us;
+  }
+  device_update();
+  IFDEF(CONFIG_HAS_PVCLOCK, pvclock_update());
+}
+
+// The polling loop keeps its locals, such as the result of io_read() in
+// AM, on the stack. Storing them does not end the wait.
+void idle_store(paddr_t addr) {
+  if (addr - guest_sp() >= IDLE_FRAME_SIZE) idle_reset();
+}
+
+void idle_poll(int wait) {
+  if (idle_mode == IDLE_OFF) return;
+  extern uint64_t g_nr_guest_inst;
+  // the polling instruction is still executing, so cpu.pc points to it
+  if (cpu.pc == last_pc && g_nr_guest_inst - last_inst <= IDLE_LOOP_MAX_INST) {
+    idle_nr_spin ++;
+  } else {
+    idle_reset();
+  }
+  last_pc = cpu.pc;
+  last_inst = g_nr_guest_inst;
+  if (idle_nr_spin >= IDLE_SPIN_THRESHOLD) {
+    // nothing changes before the next device update, except the clock
+    uint64_t next = device_next_event();
+    uint64_t us = (wait == IDLE_WAIT_INPUT || skip_us > next) ? next : skip_us;
+    idle_skip(wait, us > 0 ? us : IDLE_MIN_SKIP_US);
+    // keep counting from 1, so the next skip of this loop is doubled
+    idle_nr_spin = 1;
+    if (skip_us < 1000000 / TIMER_HZ) skip_us *= 2;
+  }
+}
+
+void idle_wfi() {
+  if (idle_mode == IDLE_OFF) return;
+  // wfi waits for an interrupt, which only comes with a device update
+  uint64_t next = device_next_event();
+  idle_skip(IDLE_WAIT_TIMER, next > 0 ? next : IDLE_MIN_SKIP_US);
+}
+
+void idle_statistic() {
+  if (nr_skip == 0) return;
+  Log("idle: %" PRIu64 " loops skipped, slept %" PRIu64 " us, warped %" PRIu64 " us",
+      nr_skip, sleep_us, idle_time_offset);
+}
@@ -16,6 +16,7 @@
 #include <isa.h>
 #include <memory/host.h>
 #include <memory/vaddr.h>
+#include <memory/paddr.h>
 #include <device/map.h>
 
 #define IO_SPACE_MAX (32 * 1024 * 1024)
@@ -29,14 +30,16 @@ uint8_t* new_space(int size) {
   size = (size + (PAGE_SIZE - 1)) & ~PAGE_MASK;
   p_space += size;
   assert(p_space - io_space < IO_SPACE_MAX);
+  add_snapshot_state("io_space", p, size);
   return p;
 }
 
-static void check_bound(IOMap *map, paddr_t addr) {
+static void check_bound(IOMap *map, paddr_t addr, int len) {
   if (map == NULL) {
     Assert(map != NULL, "address (" FMT_PADDR ") is out of bound at pc = " FMT_WORD, addr, cpu.pc);
   } else {
-    Assert(addr <= map->high && addr >= map->low,
+    // the last byte should also be inside, e.g. for an unaligned access
+    Assert(addr <= map->high && addr >= map->low && map->high - addr >= len - 1,
         "address (" FMT_PADDR ") is out of bound {%s} [" FMT_PADDR ", " FMT_PADDR "] at pc = " FMT_WORD,
         addr, map->name, map->low, map->high, cpu.pc);
   }
@@ -54,7 +57,7 @@ void init_map() {
 
 word_t map_read(paddr_t addr, int len, IOMap *map) {
   assert(len >= 1 && len <= 8);
-  check_bound(map, addr);
+  check_bound(map, addr, len);
   paddr_t offset = addr - map->low;
   invoke_callback(map->callback, offset, len, false); // prepare data to read
   word_t ret = host_read(map->space + offset, len);
@@ -63,8 +66,24 @@ word_t map_read(paddr_t addr, int len, IOMap *map) {
 
 void map_write(paddr_t addr, int len, word_t data, IOMap *map) {
   assert(len >= 1 && len <= 8);
-  check_bound(map, addr);
+  check_bound(map, addr, len);
   paddr_t offset = addr - map->low;
   host_write(map->space + offset, len, data);
   invoke_callback(map->callback, offset, len, true);
 }
+
+uint8_t* dma_guest_ptr(paddr_t addr, size_t len) {
+  if (!in_pmem(addr) || (uint64_t)(addr - CONFIG_MBASE) + len > CONFIG_MSIZE) return NULL;
+  return guest_to_host(addr);
+}
+
+void dma_guest_written(paddr_t addr, size_t len) {
+  if (len == 0) return;
+  IFDEF(CONFIG_SNAPSHOT, snapshot_mark_dirty(addr, len));
+  // the reference never sees device writes to memory, copy the result to it
+#ifdef CONFIG_DIFFTEST
+  if (ref_difftest_memcpy == NULL) return; // devices are initialized before difftest
+  difftest_sync();
+  ref_difftest_memcpy(addr, guest_to_host(addr), len, DIFFTEST_TO_REF);
+#endif
+}
@@ -15,6 +15,7 @@
 
 #include <device/map.h>
 #include <utils.h>
+#include <device/idle.h>
 
 #define KEYDOWN_MASK 0x8000
 
@@ -86,6 +87,7 @@ static void i8042_data_io_handler(uint32_t offset, int len, bool is_write) {
   assert(!is_write);
   assert(offset == 0);
   i8042_data_port_base[0] = key_dequeue();
+  IFDEF(CONFIG_IDLE_DETECT, if (i8042_data_port_base[0] == NEMU_KEY_NONE) idle_poll(IDLE_WAIT_INPUT));
 }
 
 void init_i8042() {
@@ -96,5 +98,10 @@ void init_i8042() {
 #else
   add_mmio_map("keyboard", CONFIG_I8042_DATA_MMIO, i8042_data_port_base, 4, i8042_data_io_handler);
 #endif
-  IFNDEF(CONFIG_TARGET_AM, init_keymap());
+#ifndef CONFIG_TARGET_AM
+  init_keymap();
+  add_snapshot_state("key_queue", key_queue, sizeof(key_queue));
+  add_snapshot_state("key_f", &key_f, sizeof(key_f));
+  add_snapshot_state("key_r", &key_r, sizeof(key_r));
+#endif
 }
@@ -0,0 +1,232 @@
+/***************************************************************************************
+* Copyright (c) 2014-2024 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+#include <utils.h>
+#include <device/map.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+// A network card with descriptor rings in pmem. Each descriptor is
+//   struct { uint32_t addr, len, flags, reserved; }
+// and the indices of the rings are free-running counters, the descriptor
+// of index `i` is at `ring + (i % ring_size) * 16`.
+//
+// TX: the guest fills descriptors from `tx_tail`, then writes the new
+// `tx_tail`. All of them are sent before the write returns, and `tx_head`
+// catches up with `tx_tail`.
+// RX: the guest posts empty buffers by setting `addr` and `len` (the size
+// of the buffer) and advancing `rx_tail`. The card receives packets into
+// them directly, sets `len` to the size of the packet and advances
+// `rx_head`. The backend is polled when the guest reads `rx_head` and in
+// `net_update()`.
+// The ring indices are registers, so snapshots save and restore them with
+// the I/O space, together with the rest of the state of the card.
+
+#define NET_DESC_DONE  0x1
+#define NET_DESC_TRUNC 0x2
+#define NET_DESC_ERROR 0x4 // the buffer is not in pmem, and is skipped
+
+typedef struct {
+  uint32_t addr, len, flags, reserved;
+} NetDesc;
+
+enum {
+  reg_present,
+  reg_tx_ring,
+  reg_rx_ring,
+  reg_ring_size,
+  reg_tx_head,  // RO
+  reg_tx_tail,
+  reg_rx_head,  // RO
+  reg_rx_tail,
+  nr_reg
+};
+
+static uint32_t *net_base = NULL;
+
+// backends, a packet which can not be sent is dropped as on a real wire
+static int sock_fd = -1;
+static struct sockaddr_un peer_addr;
+static FILE *pcap_out = NULL, *pcap_in = NULL;
+static uint64_t nr_tx = 0, nr_rx = 0;
+
+static void backend_send(const void *buf, uint32_t len) {
+  if (sock_fd >= 0) {
+    sendto(sock_fd, buf, len, MSG_DONTWAIT, (struct sockaddr *)&peer_addr, sizeof(peer_addr));
+  }
+  if (pcap_out != NULL) {
+    uint64_t us = get_time();
+    uint32_t rec[4] = { us / 1000000, us % 1000000, len, len };
+    fwrite(rec, sizeof(rec), 1, pcap_out);
+    fwrite(buf, len, 1, pcap_out);
+  }
+}
+
+// return the size of the packet, or -1 if there is no packet
+static int backend_recv(void *buf, uint32_t len) {
+  if (sock_fd >= 0) {
+    ssize_t ret = recv(sock_fd, buf, len, MSG_DONTWAIT | MSG_TRUNC);
+    if (ret >= 0) return ret;
+  }
+  if (pcap_in != NULL) {
+    uint32_t rec[4];
+    if (fread(rec, sizeof(rec), 1, pcap_in) == 1) {
+      uint32_t n = (rec[2] < len ? rec[2] : len);
+      int ret = fread(buf, 1, n, pcap_in);
+      if (rec[2] > n) fseek(pcap_in, rec[2] - n, SEEK_CUR);
+      if (ret == n) return rec[2];
+    }
+    fclose(pcap_in);
+    pcap_in = NULL;
+  }
+  return -1;
+}
+
+// return NULL if the descriptor is not in pmem, it is skipped then
+static NetDesc* get_desc(uint32_t ring, uint32_t idx) {
+  paddr_t addr = ring + (idx % net_base[reg_ring_size]) * sizeof(NetDesc);
+  return (NetDesc *)dma_guest_ptr(addr, sizeof(NetDesc));
+}
+
+static void desc_written(uint32_t ring, uint32_t idx) {
+  dma_guest_written(ring + (idx % net_base[reg_ring_size]) * sizeof(NetDesc), sizeof(NetDesc));
+}
+
+// A tail more than a ring ahead of its head is a mistake of the guest.
+// Serving it would walk the ring up to 2^32 times in a single MMIO write,
+// so the tail is moved back to the head, and nothing is handed to the card.
+static bool ring_check(int head, int tail, const char *name) {
+  if (net_base[tail] - net_base[head] <= net_base[reg_ring_size]) return true;
+  Log("NET: %s_tail = %u is more than %u descriptors ahead of %s_head = %u, ignored",
+      name, net_base[tail], net_base[reg_ring_size], name, net_base[head]);
+  net_base[tail] = net_base[head];
+  return false;
+}
+
+static void net_tx() {
+  if (net_base[reg_ring_size] == 0) return;
+  if (!ring_check(reg_tx_head, reg_tx_tail, "tx")) return;
+  uint32_t ring = net_base[reg_tx_ring];
+  for (; net_base[reg_tx_head] != net_base[reg_tx_tail]; net_base[reg_tx_head] ++) {
+    NetDesc *d = get_desc(ring, net_base[reg_tx_head]);
+    if (d == NULL) continue;
+    uint8_t *p = dma_guest_ptr(d->addr, d->len);
+    if (p != NULL) {
+      backend_send(p, d->len);
+      nr_tx ++;
+    }
+    d->flags = NET_DESC_DONE | (p == NULL ? NET_DESC_ERROR : 0);
+    desc_written(ring, net_base[reg_tx_head]);
+  }
+}
+
+static void net_rx() {
+  if (net_base[reg_ring_size] == 0) return;
+  if (!ring_check(reg_rx_head, reg_rx_tail, "rx")) return;
+  uint32_t ring = net_base[reg_rx_ring];
+  for (; net_base[reg_rx_head] != net_base[reg_rx_tail]; net_base[reg_rx_head] ++) {
+    NetDesc *d = get_desc(ring, net_base[reg_rx_head]);
+    if (d == NULL) continue;
+    uint8_t *p = dma_guest_ptr(d->addr, d->len);
+    if (p == NULL) {
+      d->flags = NET_DESC_DONE | NET_DESC_ERROR;
+      d->len = 0;
+      desc_written(ring, net_base[reg_rx_head]);
+      continue;
+    }
+    int ret = backend_recv(p, d->len);
+    if (ret < 0) break;
+    d->flags = NET_DESC_DONE | (ret > d->len ? NET_DESC_TRUNC : 0);
+    d->len = (ret > d->len ? d->len : ret);
+    dma_guest_written(d->addr, d->len);
+    desc_written(ring, net_base[reg_rx_head]);
+    nr_rx ++;
+  }
+}
+
+void net_update() {
+  net_rx();
+}
+
+static void net_io_handler(uint32_t offset, int len, bool is_write) {
+  switch (offset / sizeof(uint32_t)) {
+    case reg_tx_tail: if (is_write) net_tx(); break;
+    case reg_rx_head: if (!is_write) net_rx(); break;
+  }
+}
+
+static char *net_spec = NULL;
+
+void net_set_backend(char *spec) {
+  net_spec = spec;
+}
+
+static void init_unix(char *local, char *peer) {
+  Assert(local != NULL && peer != NULL, "Invalid NET backend, expect unix:LOCAL:PEER");
+  sock_fd = socket(AF_UNIX, SOCK_DGRAM, 0);
+  Assert(sock_fd >= 0, "Can not create socket");
+  struct sockaddr_un addr = { .sun_family = AF_UNIX };
+  Assert(strlen(local) < sizeof(addr.sun_path) && strlen(peer) < sizeof(addr.sun_path),
+      "Path of socket is too long");
+  strcpy(addr.sun_path, local);
+  unlink(local);
+  int ret = bind(sock_fd, (struct sockaddr *)&addr, sizeof(addr));
+  Assert(ret == 0, "Can not bind to '%s'", local);
+  peer_addr = (struct sockaddr_un) { .sun_family = AF_UNIX };
+  strcpy(peer_addr.sun_path, peer);
+}
+
+static void init_pcap(char *out, char *in) {
+  Assert(out != NULL, "Invalid NET backend, expect pcap:OUT[:IN]");
+  // the global header, with LINKTYPE_ETHERNET
+  uint32_t hdr[6] = { 0xa1b2c3d4, 0x00040002, 0, 0, 65535, 1 };
+  pcap_out = fopen(out, "wb");
+  Assert(pcap_out, "Can not open '%s'", out);
+  setvbuf(pcap_out, NULL, _IOFBF, 1 << 20);
+  fwrite(hdr, sizeof(hdr), 1, pcap_out);
+  if (in != NULL) {
+    pcap_in = fopen(in, "rb");
+    Assert(pcap_in, "Can not open '%s'", in);
+    int ret = fread(hdr, sizeof(hdr), 1, pcap_in);
+    Assert(ret == 1 && hdr[0] == 0xa1b2c3d4, "'%s' is not a pcap file", in);
+  }
+}
+
+static void net_report() {
+  Log("NET: %" PRIu64 " packets sent, %" PRIu64 " packets received", nr_tx, nr_rx);
+}
+
+void init_net() {
+  uint32_t space_size = sizeof(uint32_t) * nr_reg;
+  net_base = (uint32_t *)new_space(space_size);
+  net_base[reg_present] = 1;
+#ifdef CONFIG_HAS_PORT_IO
+  add_pio_map ("net", CONFIG_NET_CTL_PORT, net_base, space_size, net_io_handler);
+#else
+  add_mmio_map("net", CONFIG_NET_CTL_MMIO, net_base, space_size, net_io_handler);
+#endif
+
+  if (net_spec == NULL) return;
+  char *type = strtok(net_spec, ":");
+  char *arg1 = strtok(NULL, ":");
+  char *arg2 = strtok(NULL, ":");
+  if (strcmp(type, "unix") == 0) init_unix(arg1, arg2);
+  else if (strcmp(type, "pcap") == 0) init_pcap(arg1, arg2);
+  else panic("Unknown NET backend '%s', expect unix or pcap", type);
+  Log("NET backend: %s", type);
+  atexit(net_report);
+}
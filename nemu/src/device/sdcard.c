@@ -14,7 +14,9 @@
 ***************************************************************************************/
 
 #include <device/map.h>
+#include <device/blkimg.h>
 #include "mmc.h"
+#include <unistd.h>
 
 // http://www.files.e-shop.co.il/pdastore/Tech-mmc-samsung/SEC%20MMC%20SPEC%20ver09.pdf
 
@@ -28,19 +30,30 @@
 #define C_SIZE (NR_BLOCK / MULT - 1)
 
 // This is a simple hardware implementation of linux/drivers/mmc/host/bcm2835.c
-// No DMA and IRQ is supported, so the driver must be modified to start PIO
+// No IRQ is supported, so the driver must be modified to start the transfer
 // right after sending the actual read/write commands.
+//
+// Besides PIO through SDDATA, data can be moved by DMA: writing SDDMALEN
+// transfers SDDMALEN bytes between the card and pmem at SDDMAADDR at once,
+// continuing from the current position of the read/write command.
+//
+// PIO does not touch the image for every word. Reads are served from a
+// staging buffer which is refilled with readahead, so that the blocks of
+// a MMC_READ_MULTIPLE_BLOCK sequence come from one copy. Writes are
+// collected in another buffer and flushed when a non-contiguous write or a
+// read comes, when the buffer is full, or at exit.
 
 enum {
   SDCMD, SDARG, SDTOUT, SDCDIV,
   SDRSP0, SDRSP1, SDRSP2, SDRSP3,
-  SDHSTS, __PAD0, __PAD1, __PAD2,
+  SDHSTS, SDDMAADDR, SDDMALEN, __PAD2,
   SDVDD, SDEDM, SDHCFG, SDHBCT,
   SDDATA, __PAD10, __PAD11, __PAD12,
   SDHBLC
 };
 
-static FILE *fp = NULL;
+static BlkImg *img = NULL;
+static const char *overlay = NULL;
 static uint32_t *base = NULL;
 static uint32_t blkcnt = 0;
 static long blk_addr = 0;
@@ -48,10 +61,67 @@ static uint32_t addr = 0;
 static bool write_cmd = 0;
 static bool read_ext_csd = false;
 
+#define STAGE_SIZE (64 * 1024)
+static uint8_t rstage[STAGE_SIZE];
+static uint64_t rstage_off = 0;
+static uint32_t rstage_len = 0;
+static uint8_t wstage[STAGE_SIZE];
+static uint64_t wstage_off = 0;
+static uint32_t wstage_len = 0;
+
+static void flush_write() {
+  if (wstage_len == 0) return;
+  blkimg_write(img, wstage_off, wstage, wstage_len);
+  // the read stage may hold stale data of the written blocks
+  if (wstage_off < rstage_off + rstage_len && rstage_off < wstage_off + wstage_len) {
+    rstage_len = 0;
+  }
+  wstage_len = 0;
+}
+
+static uint32_t pio_read(uint64_t off) {
+  if (off < rstage_off || off + 4 > rstage_off + rstage_len) {
+    blkimg_read(img, off, rstage, STAGE_SIZE);
+    rstage_off = off;
+    rstage_len = STAGE_SIZE;
+  }
+  uint32_t data;
+  memcpy(&data, rstage + (off - rstage_off), 4);
+  return data;
+}
+
+static void pio_write(uint64_t off, uint32_t data) {
+  if (wstage_len != 0 && (off != wstage_off + wstage_len || wstage_len == STAGE_SIZE)) {
+    flush_write();
+  }
+  if (wstage_len == 0) wstage_off = off;
+  memcpy(wstage + wstage_len, &data, 4);
+  wstage_len += 4;
+}
+
+static void dma_transfer() {
+  Assert(img != NULL && !read_ext_csd, "DMA is not supported for this command");
+  paddr_t buf = base[SDDMAADDR];
+  uint32_t len = base[SDDMALEN];
+  uint8_t *p = dma_guest_ptr(buf, len);
+  Assert(p != NULL, "DMA buffer [" FMT_PADDR ", +0x%x) is out of pmem", buf, len);
+  uint64_t off = (blk_addr << 9) + addr;
+  flush_write();
+  if (!write_cmd) {
+    blkimg_read(img, off, p, len);
+    dma_guest_written(buf, len);
+  } else {
+    blkimg_write(img, off, p, len);
+    if (off < rstage_off + rstage_len && rstage_off < off + len) rstage_len = 0;
+  }
+  addr += len;
+}
+
 static void prepare_rw(int is_write) {
+  // reads should see the data written before
+  if (!is_write) flush_write();
   blk_addr = base[SDARG];
   addr = 0;
-  if (fp) fseek(fp, blk_addr << 9, SEEK_SET);
   write_cmd = is_write;
 }
 
@@ -92,6 +162,8 @@ static void sdcard_io_handler(uint32_t offset, int len, bool is_write) {
   int idx = offset / 4;
   switch (idx) {
     case SDCMD: sdcard_handle_cmd(base[SDCMD] & 0x3f); break;
+    case SDDMALEN: if (is_write) dma_transfer(); break;
+    case SDDMAADDR:
     case SDARG:
     case SDRSP0:
     case SDRSP1:
@@ -109,10 +181,10 @@ static void sdcard_io_handler(uint32_t offset, int len, bool is_write) {
          }
          base[SDDATA] = data;
          if (addr == 512 - 4) read_ext_csd = false;
-       } else if (fp) {
-         __attribute__((unused)) int ret;
-         if (!write_cmd) { ret = fread(&base[SDDATA], 4, 1, fp); }
-         else { ret = fwrite(&base[SDDATA], 4, 1, fp); }
+       } else if (img) {
+         uint64_t off = (blk_addr << 9) + addr;
+         if (!write_cmd) { base[SDDATA] = pio_read(off); }
+         else { pio_write(off, base[SDDATA]); }
        }
        addr += 4;
        break;
@@ -122,13 +194,32 @@ static void sdcard_io_handler(uint32_t offset, int len, bool is_write) {
   }
 }
 
+void sdcard_set_overlay(const char *file) {
+  overlay = file;
+}
+
 void init_sdcard() {
   base = (uint32_t *)new_space(0x80);
   add_mmio_map("sdhci", CONFIG_SDCARD_CTL_MMIO, base, 0x80, sdcard_io_handler);
+  // the position of the current command, the image itself is not saved
+  add_snapshot_state("blk_addr", &blk_addr, sizeof(blk_addr));
+  add_snapshot_state("addr", &addr, sizeof(addr));
+  add_snapshot_state("write_cmd", &write_cmd, sizeof(write_cmd));
+  add_snapshot_state("read_ext_csd", &read_ext_csd, sizeof(read_ext_csd));
+  add_snapshot_state("rstage", rstage, sizeof(rstage));
+  add_snapshot_state("rstage_off", &rstage_off, sizeof(rstage_off));
+  add_snapshot_state("rstage_len", &rstage_len, sizeof(rstage_len));
+  add_snapshot_state("wstage", wstage, sizeof(wstage));
+  add_snapshot_state("wstage_off", &wstage_off, sizeof(wstage_off));
+  add_snapshot_state("wstage_len", &wstage_len, sizeof(wstage_len));
 
   Assert(C_SIZE < (1 << 12), "shoule be fit in 12 bits");
 
-  const char *img = CONFIG_SDCARD_IMG_PATH;
-  fp = fopen(img, "r+");
-  if (fp == NULL) Log("Can not find sdcard image: %s", img);
+  const char *path = CONFIG_SDCARD_IMG_PATH;
+  if (access(path, F_OK) == 0) {
+    img = blkimg_open(path, overlay);
+    atexit(flush_write);
+  } else {
+    Log("Can not find sdcard image: %s", path);
+  }
 }
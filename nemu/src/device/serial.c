@@ -20,22 +20,115 @@
 // NOTE: this is compatible to 16550
 
 #define CH_OFFSET 0
+#define LSR_OFFSET 5
+
+#define LSR_DR   0x01 // data ready
+#define LSR_THRE 0x20 // transmitter holding register empty
+#define LSR_TEMT 0x40 // transmitter empty
 
 static uint8_t *serial_base = NULL;
 
+#ifndef CONFIG_TARGET_AM
+// The output is buffered, since a write() for every byte costs much more
+// than emulating the guest code which prints it. The buffer is flushed on
+// a newline, when it is full, when the CPU stops and at exit.
+#define OBUF_SIZE 4096
+static char obuf[OBUF_SIZE];
+static int obuf_len = 0;
+
+void serial_flush() {
+  if (obuf_len == 0) return;
+  fwrite(obuf, 1, obuf_len, stderr);
+  obuf_len = 0;
+}
 
 static void serial_putc(char ch) {
-  MUXDEF(CONFIG_TARGET_AM, putch(ch), putc(ch, stderr));
+  obuf[obuf_len ++] = ch;
+  if (ch == '\n' || obuf_len == OBUF_SIZE) serial_flush();
+}
+#else
+void serial_flush() {}
+
+static void serial_putc(char ch) {
+  putch(ch);
+}
+#endif
+
+#ifdef CONFIG_SERIAL_INPUT_FIFO
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+// Input bytes are queued here. The input file is only polled from
+// `serial_update()`, so the guest can spin on LSR without any syscall.
+#define RX_QUEUE_LEN 1024
+static uint8_t rx_queue[RX_QUEUE_LEN];
+static int rx_head = 0, rx_tail = 0;
+static int rx_fd = -1;
+
+static bool rx_empty() { return rx_head == rx_tail; }
+
+static uint8_t rx_dequeue() {
+  uint8_t ch = rx_queue[rx_head];
+  rx_head = (rx_head + 1) % RX_QUEUE_LEN;
+  return ch;
+}
+
+void serial_update() {
+  if (rx_fd < 0) return;
+  int nfree = (rx_head - rx_tail - 1 + RX_QUEUE_LEN) % RX_QUEUE_LEN;
+  if (nfree == 0) return;
+  struct pollfd pfd = { .fd = rx_fd, .events = POLLIN };
+  if (poll(&pfd, 1, 0) <= 0 || !(pfd.revents & POLLIN)) return;
+
+  // read at most up to the end of the queue, the rest is read next time
+  int n = RX_QUEUE_LEN - rx_tail;
+  if (n > nfree) n = nfree;
+  ssize_t ret = read(rx_fd, rx_queue + rx_tail, n);
+  if (ret > 0) rx_tail = (rx_tail + ret) % RX_QUEUE_LEN;
 }
 
+static void init_fifo() {
+  const char *path = CONFIG_SERIAL_INPUT_PATH;
+  if (strcmp(path, "-") == 0) {
+    rx_fd = STDIN_FILENO;
+  } else {
+    if (access(path, F_OK) != 0) {
+      int ret = mkfifo(path, 0666);
+      Assert(ret == 0, "Can not create FIFO '%s'", path);
+    }
+    // do not block when there is no writer
+    rx_fd = open(path, O_RDONLY | O_NONBLOCK);
+    Assert(rx_fd >= 0, "Can not open '%s'", path);
+  }
+  Log("Serial input comes from %s", path);
+  add_snapshot_state("rx_queue", rx_queue, sizeof(rx_queue));
+  add_snapshot_state("rx_head", &rx_head, sizeof(rx_head));
+  add_snapshot_state("rx_tail", &rx_tail, sizeof(rx_tail));
+}
+#else
+void serial_update() {}
+static bool rx_empty() { return true; }
+static uint8_t rx_dequeue() { return 0; }
+#endif
+
 static void serial_io_handler(uint32_t offset, int len, bool is_write) {
   assert(len == 1);
   switch (offset) {
     /* We bind the serial port with the host stderr in NEMU. */
     case CH_OFFSET:
       if (is_write) serial_putc(serial_base[0]);
-      else panic("do not support read");
+      else serial_base[0] = (rx_empty() ? 0 : rx_dequeue());
+      break;
+    case LSR_OFFSET:
+      if (!is_write) {
+        // output never blocks, so the transmitter is always ready
+        serial_base[5] = LSR_THRE | LSR_TEMT | (rx_empty() ? 0 : LSR_DR);
+      }
       break;
+    // other registers only configure the line, just keep their values
+    case 1: case 2: case 3: case 4: case 6: case 7: break;
     default: panic("do not support offset = %d", offset);
   }
 }
@@ -48,4 +141,6 @@ void init_serial() {
   add_mmio_map("serial", CONFIG_SERIAL_MMIO, serial_base, 8, serial_io_handler);
 #endif
 
+  IFNDEF(CONFIG_TARGET_AM, atexit(serial_flush));
+  IFDEF(CONFIG_SERIAL_INPUT_FIFO, init_fifo());
 }
@@ -0,0 +1,103 @@
+/***************************************************************************************
+* Copyright (c) 2014-2024 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+#include <common.h>
+#include <utils.h>
+#include <device/alarm.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <SDL2/SDL.h>
+
+// The device thread owns SDL: it presents the frames published by the VGA
+// and polls the SDL events. Thus the CPU thread never blocks in
+// SDL_RenderPresent() waiting for vsync.
+
+void vga_thread_init();
+void vga_present_frame();
+void send_key(uint8_t, bool);
+
+// Key events are passed to the CPU thread through a single-producer
+// single-consumer ring. Each entry is the SDL scancode, with bit 8 set
+// for a key down event.
+#define EVENT_QUEUE_LEN 1024
+static uint16_t event_queue[EVENT_QUEUE_LEN];
+static uint32_t event_head = 0; // written by the CPU thread
+static uint32_t event_tail = 0; // written by the device thread
+static bool quit = false;
+static bool ready = false;
+
+static void event_enqueue(uint8_t scancode, bool is_keydown) {
+  uint32_t tail = event_tail;
+  if (tail - __atomic_load_n(&event_head, __ATOMIC_ACQUIRE) == EVENT_QUEUE_LEN) {
+    return; // the guest does not read the keyboard, drop the event
+  }
+  event_queue[tail % EVENT_QUEUE_LEN] = scancode | (is_keydown ? 0x100 : 0);
+  __atomic_store_n(&event_tail, tail + 1, __ATOMIC_RELEASE);
+}
+
+static void *device_thread(void *arg) {
+  IFDEF(CONFIG_VGA_SHOW_SCREEN, vga_thread_init());
+  __atomic_store_n(&ready, true, __ATOMIC_RELEASE);
+
+  uint64_t next = get_time();
+  while (true) {
+    IFDEF(CONFIG_VGA_SHOW_SCREEN, vga_present_frame());
+
+    SDL_Event event;
+    while (SDL_PollEvent(&event)) {
+      switch (event.type) {
+        case SDL_QUIT: __atomic_store_n(&quit, true, __ATOMIC_RELEASE); break;
+        case SDL_KEYDOWN:
+        case SDL_KEYUP:
+          event_enqueue(event.key.keysym.scancode, event.key.type == SDL_KEYDOWN);
+          break;
+        default: break;
+      }
+    }
+
+    next += 1000000 / TIMER_HZ;
+    uint64_t now = get_time();
+    if (next > now) usleep(next - now);
+    else next = now;
+  }
+  return NULL;
+}
+
+// called by the CPU thread in device_update()
+void device_thread_update() {
+  if (__atomic_load_n(&quit, __ATOMIC_ACQUIRE)) {
+    nemu_state.state = NEMU_QUIT;
+  }
+  uint32_t head = event_head;
+  uint32_t tail = __atomic_load_n(&event_tail, __ATOMIC_ACQUIRE);
+  for (; head != tail; head ++) {
+    uint16_t e = event_queue[head % EVENT_QUEUE_LEN];
+    IFDEF(CONFIG_HAS_KEYBOARD, send_key(e & 0xff, e >> 8));
+  }
+  __atomic_store_n(&event_head, head, __ATOMIC_RELEASE);
+}
+
+void device_thread_clear_events() {
+  __atomic_store_n(&event_head, __atomic_load_n(&event_tail, __ATOMIC_ACQUIRE), __ATOMIC_RELEASE);
+}
+
+void init_device_thread() {
+  pthread_t thread;
+  int ret = pthread_create(&thread, NULL, device_thread, NULL);
+  Assert(ret == 0, "Can not create the device thread");
+  pthread_detach(thread);
+  // devices may use SDL after initialization, wait until it is set up
+  while (!__atomic_load_n(&ready, __ATOMIC_ACQUIRE)) usleep(1000);
+}
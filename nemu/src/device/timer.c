@@ -15,19 +15,93 @@
 
 #include <device/map.h>
 #include <device/alarm.h>
+#include <device/idle.h>
+#include <memory/host.h>
+#include <cpu/difftest.h>
 #include <utils.h>
 
 static uint32_t *rtc_port_base = NULL;
 
+// offset 8 holds the address of the clock page, or 0 without it
+#define RTC_SIZE 12
+
 static void rtc_io_handler(uint32_t offset, int len, bool is_write) {
-  assert(offset == 0 || offset == 4);
+  assert(offset == 0 || offset == 4 || offset == 8);
   if (!is_write && offset == 4) {
-    uint64_t us = get_time();
+    IFDEF(CONFIG_IDLE_DETECT, idle_poll(IDLE_WAIT_TIMER));
+    uint64_t us = get_guest_time();
     rtc_port_base[0] = (uint32_t)us;
     rtc_port_base[1] = us >> 32;
   }
+  if (!is_write && offset == 8) {
+    rtc_port_base[2] = MUXDEF(CONFIG_HAS_PVCLOCK, CONFIG_PVCLOCK_ADDR, 0);
+  }
+}
+
+#ifdef CONFIG_HAS_PVCLOCK
+// The clock page works like a seqlock. NEMU makes the sequence number odd
+// before it updates the time and even again after that. The guest reads
+// the sequence number, the time, and the sequence number again, and
+// retries if they differ or the sequence number is odd.
+//
+//   offset 0: sequence number
+//   offset 4: PVCLOCK_MAGIC, the guest falls back to the RTC without it
+//   offset 8: time in us, low 32 bits
+//   offset 12: time in us, high 32 bits
+//
+// The page is outside pmem, and the guest finds it at offset 8 of the RTC.
+// Guest writes to it are dropped.
+#define PVCLOCK_MAGIC 0x4b435650 // "PVCK"
+static uint32_t *pvclock = NULL;
+
+void pvclock_update() {
+  uint64_t us = get_guest_time();
+  pvclock[0] ++;
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+  pvclock[2] = (uint32_t)us;
+  pvclock[3] = us >> 32;
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+  pvclock[0] ++;
 }
 
+// called by device_update() after every instruction
+void pvclock_tick() {
+  static uint32_t nr_inst = 0;
+  if (++ nr_inst >= CONFIG_PVCLOCK_PERIOD) {
+    nr_inst = 0;
+    pvclock_update();
+  }
+}
+
+static void pvclock_reset() {
+  memset(pvclock, 0, PAGE_SIZE);
+  pvclock[1] = PVCLOCK_MAGIC;
+  pvclock_update();
+}
+
+// the fast path of paddr_read(), which skips the search of MMIO maps
+word_t pvclock_read(paddr_t addr, int len) {
+  // a read of the time is a poll, just like a read of the RTC
+  IFDEF(CONFIG_IDLE_DETECT, if (addr - CONFIG_PVCLOCK_ADDR == 8) idle_poll(IDLE_WAIT_TIMER));
+  word_t ret = host_read((uint8_t *)pvclock + (addr - CONFIG_PVCLOCK_ADDR), len);
+  difftest_mmio(addr, len, ret, false);
+  return ret;
+}
+
+static void pvclock_io_handler(uint32_t offset, int len, bool is_write) {
+  // the page is read-only, undo the write
+  if (is_write) pvclock_reset();
+}
+
+static void init_pvclock() {
+  Assert((CONFIG_PVCLOCK_ADDR & (PAGE_SIZE - 1)) == 0,
+      "clock page " FMT_PADDR " is not page aligned", (paddr_t)CONFIG_PVCLOCK_ADDR);
+  pvclock = (uint32_t *)new_space(PAGE_SIZE);
+  pvclock_reset();
+  add_mmio_map("pvclock", CONFIG_PVCLOCK_ADDR, pvclock, PAGE_SIZE, pvclock_io_handler);
+}
+#endif
+
 #ifndef CONFIG_TARGET_AM
 static void timer_intr() {
   if (nemu_state.state == NEMU_RUNNING) {
@@ -38,11 +112,12 @@ static void timer_intr() {
 #endif
 
 void init_timer() {
-  rtc_port_base = (uint32_t *)new_space(8);
+  rtc_port_base = (uint32_t *)new_space(RTC_SIZE);
 #ifdef CONFIG_HAS_PORT_IO
-  add_pio_map ("rtc", CONFIG_RTC_PORT, rtc_port_base, 8, rtc_io_handler);
+  add_pio_map ("rtc", CONFIG_RTC_PORT, rtc_port_base, RTC_SIZE, rtc_io_handler);
 #else
-  add_mmio_map("rtc", CONFIG_RTC_MMIO, rtc_port_base, 8, rtc_io_handler);
+  add_mmio_map("rtc", CONFIG_RTC_MMIO, rtc_port_base, RTC_SIZE, rtc_io_handler);
 #endif
   IFNDEF(CONFIG_TARGET_AM, add_alarm_handle(timer_intr));
+  IFDEF(CONFIG_HAS_PVCLOCK, init_pvclock());
 }
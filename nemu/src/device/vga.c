@@ -14,6 +14,7 @@
 ***************************************************************************************/
 
 #include <common.h>
+#include <utils.h>
 #include <device/map.h>
 
 #define SCREEN_W (MUXDEF(CONFIG_VGA_SIZE_800x600, 800, 400))
@@ -34,6 +35,19 @@ static uint32_t screen_size() {
 static void *vmem = NULL;
 static uint32_t *vgactl_port_base = NULL;
 
+enum {
+  reg_size,       // RO, (width << 16) | height
+  reg_sync,
+  // 2D acceleration
+  reg_cmd,        // writing GPU_CMD_* executes the command
+  reg_arg0,
+  reg_arg1,
+  reg_arg2,
+  reg_tmem_size,  // RO, size of the texture memory, 0 without acceleration
+  nr_reg
+};
+#define VGACTL_SIZE (nr_reg * sizeof(uint32_t))
+
 #ifdef CONFIG_VGA_SHOW_SCREEN
 #ifndef CONFIG_TARGET_AM
 #include <SDL2/SDL.h>
@@ -56,8 +70,8 @@ static void init_screen() {
   SDL_RenderPresent(renderer);
 }
 
-static inline void update_screen() {
-  SDL_UpdateTexture(texture, NULL, vmem, SCREEN_W * sizeof(uint32_t));
+static inline void update_screen(void *pixels) {
+  SDL_UpdateTexture(texture, NULL, pixels, SCREEN_W * sizeof(uint32_t));
   SDL_RenderClear(renderer);
   SDL_RenderCopy(renderer, texture, NULL, NULL);
   SDL_RenderPresent(renderer);
@@ -65,28 +79,269 @@ static inline void update_screen() {
 #else
 static void init_screen() {}
 
-static inline void update_screen() {
-  io_write(AM_GPU_FBDRAW, 0, 0, vmem, screen_width(), screen_height(), true);
+static inline void update_screen(void *pixels) {
+  io_write(AM_GPU_FBDRAW, 0, 0, pixels, screen_width(), screen_height(), true);
+}
+#endif
+
+#ifdef CONFIG_DEVICE_THREAD
+// Frames are handed over to the device thread with triple buffering.
+// The CPU thread owns frame[frame_back] and the device thread owns
+// frame[frame_front]. The spare buffer is swapped in and out of frame_mid
+// atomically, so neither thread ever waits for the other.
+#define FRAME_FRESH 0x4
+static uint32_t *frame[3] = {};
+static int frame_back = 0, frame_front = 1, frame_mid = 2;
+
+static void publish_frame() {
+  memcpy(frame[frame_back], vmem, screen_size());
+  int old = __atomic_exchange_n(&frame_mid, frame_back | FRAME_FRESH, __ATOMIC_ACQ_REL);
+  frame_back = old & ~FRAME_FRESH;
+}
+
+// called by the device thread
+void vga_present_frame() {
+  if (!(__atomic_load_n(&frame_mid, __ATOMIC_ACQUIRE) & FRAME_FRESH)) return;
+  int old = __atomic_exchange_n(&frame_mid, frame_front, __ATOMIC_ACQ_REL);
+  frame_front = old & ~FRAME_FRESH;
+  update_screen(frame[frame_front]);
+}
+#endif
+#endif
+
+#ifndef CONFIG_TARGET_AM
+// Headless frame capture. A frame is captured exactly when the guest writes
+// the sync register, so the output only depends on the guest program and
+// not on the host timer, which makes it suitable for regression checks.
+enum { CAPTURE_NONE, CAPTURE_RAW, CAPTURE_PPM, CAPTURE_HASH };
+static int capture_fmt = CAPTURE_NONE;
+static FILE *capture_fp = NULL;
+static uint8_t *capture_buf = NULL;
+static uint64_t nr_frame = 0;
+
+void vga_set_capture(const char *spec) {
+  const char *colon = strchr(spec, ':');
+  Assert(colon != NULL && colon[1] != '\0', "Invalid VGA capture '%s', expect FMT:FILE", spec);
+  int n = colon - spec;
+  if (n == 3 && strncmp(spec, "raw", n) == 0) capture_fmt = CAPTURE_RAW;
+  else if (n == 3 && strncmp(spec, "ppm", n) == 0) capture_fmt = CAPTURE_PPM;
+  else if (n == 4 && strncmp(spec, "hash", n) == 0) capture_fmt = CAPTURE_HASH;
+  else panic("Unknown VGA capture format '%.*s', expect raw, ppm or hash", n, spec);
+
+  const char *file = colon + 1;
+  capture_fp = (strcmp(file, "-") == 0 ? stdout : fopen(file, "wb"));
+  Assert(capture_fp, "Can not open '%s'", file);
+  // frames are large, let the C library collect them into big writes
+  if (capture_fp != stdout) setvbuf(capture_fp, NULL, _IOFBF, 1 << 20);
+}
+
+static void capture_frame() {
+  uint32_t w = screen_width(), h = screen_height();
+  switch (capture_fmt) {
+    case CAPTURE_RAW:
+      // ARGB8888 pixels as they are in vmem, one frame after another
+      fwrite(vmem, screen_size(), 1, capture_fp);
+      break;
+    case CAPTURE_PPM: {
+      // a stream of binary PPM images, which can be fed to ffmpeg directly
+      if (capture_buf == NULL) capture_buf = malloc(w * h * 3);
+      uint32_t *p = vmem;
+      uint8_t *q = capture_buf;
+      for (uint32_t i = 0; i < w * h; i ++, q += 3) {
+        q[0] = p[i] >> 16; q[1] = p[i] >> 8; q[2] = p[i];
+      }
+      fprintf(capture_fp, "P6\n%d %d\n255\n", w, h);
+      fwrite(capture_buf, w * h * 3, 1, capture_fp);
+      break;
+    }
+    case CAPTURE_HASH:
+      fprintf(capture_fp, "%" PRIu64 " %016" PRIx64 "\n",
+          nr_frame, hash64(vmem, screen_size(), HASH64_INIT));
+      break;
+  }
+  nr_frame ++;
+}
+
+#endif
+
+#ifdef CONFIG_VGA_ACCEL
+// 2D acceleration of AM_GPU_MEMCPY and AM_GPU_RENDER. Textures and the
+// canvas tree live in the texture memory of the device, and pointers in the
+// tree are offsets in it, just as `gpuptr_t` in amdev.h.
+//   GPU_CMD_MEMCPY: copy arg2 bytes from pmem at arg1 to the offset arg0
+//   GPU_CMD_RENDER: composite the canvas tree with the root at the offset
+//                   arg0 into vmem
+enum { GPU_CMD_MEMCPY = 1, GPU_CMD_RENDER = 2 };
+
+#define GPU_TEXTURE 1
+#define GPU_SUBTREE 2
+#define GPU_NULL    0xffffffff
+#define GPU_MAX_DEPTH 32
+
+typedef struct {
+  uint16_t type, w, h, x1, y1, w1, h1;
+  uint32_t sibling;
+  union {
+    uint32_t child;
+    struct { uint16_t w, h; uint32_t pixels; } __attribute__((packed)) texture;
+  };
+} __attribute__((packed)) GPUCanvas;
+
+static uint8_t *tmem = NULL;
+// scratch buffers for the subtrees, allocated like a stack
+static uint32_t *scratch = NULL;
+static size_t scratch_top = 0;
+#define SCRATCH_LEN (CONFIG_VGA_TMEM_SIZE / sizeof(uint32_t))
+
+static void* tmem_ptr(uint32_t off, size_t len) {
+  Assert(off <= CONFIG_VGA_TMEM_SIZE && len <= CONFIG_VGA_TMEM_SIZE - off,
+      "GPU: [0x%x, +0x%zx) is out of the texture memory", off, len);
+  return tmem + off;
+}
+
+static void gpu_memcpy(uint32_t dst, paddr_t src, uint32_t size) {
+  void *p = dma_guest_ptr(src, size);
+  Assert(p != NULL, "GPU: source [" FMT_PADDR ", +0x%x) is out of pmem", src, size);
+  memcpy(tmem_ptr(dst, size), p, size);
+}
+
+// Draw the `w * h` pixels of `src` scaled to `w1 * h1` at (x1, y1)
+// of `dst`, which has `W * H` pixels. The part outside `dst` is clipped.
+static void blit(uint32_t *dst, int W, int H, const uint32_t *src, int w, int h,
+    int x1, int y1, int w1, int h1) {
+  if (w == 0 || h == 0) return;
+  int xend = (x1 + w1 < W ? x1 + w1 : W);
+  int yend = (y1 + h1 < H ? y1 + h1 : H);
+  int n = xend - x1;
+  if (n <= 0) return;
+  // the source column of every destination column is computed once
+  static int sx[65536];
+  bool same_w = (w == w1);
+  if (!same_w) {
+    for (int i = 0; i < n; i ++) sx[i] = i * w / w1;
+  }
+  for (int y = y1; y < yend; y ++) {
+    const uint32_t *s = src + (size_t)w * ((y - y1) * h / h1);
+    uint32_t *d = dst + (size_t)W * y + x1;
+    // rows without horizontal scaling are plain copies, which the C
+    // library performs with vector instructions
+    if (same_w) memcpy(d, s, n * sizeof(uint32_t));
+    else for (int i = 0; i < n; i ++) d[i] = s[sx[i]];
+  }
+}
+
+static void render(uint32_t off, uint32_t *dst, int W, int H, int depth) {
+  Assert(depth < GPU_MAX_DEPTH, "GPU: the canvas tree is too deep");
+  GPUCanvas cv;
+  memcpy(&cv, tmem_ptr(off, sizeof(cv)), sizeof(cv));
+
+  const uint32_t *src;
+  int w, h;
+  size_t old_top = scratch_top;
+  switch (cv.type) {
+    case GPU_TEXTURE:
+      w = cv.texture.w; h = cv.texture.h;
+      src = tmem_ptr(cv.texture.pixels, (size_t)w * h * sizeof(uint32_t));
+      break;
+    case GPU_SUBTREE: {
+      w = cv.w; h = cv.h;
+      size_t npixel = (size_t)w * h;
+      Assert(npixel <= SCRATCH_LEN - scratch_top, "GPU: no memory for the subtree");
+      uint32_t *buf = scratch + scratch_top;
+      scratch_top += npixel;
+      memset(buf, 0, npixel * sizeof(uint32_t));
+      // the number of siblings is bounded to stop at a loop in the list
+      uint32_t ch = cv.child;
+      for (int i = 0; ch != GPU_NULL && i < CONFIG_VGA_TMEM_SIZE / sizeof(GPUCanvas); i ++) {
+        render(ch, buf, w, h, depth + 1);
+        GPUCanvas *c = tmem_ptr(ch, sizeof(GPUCanvas));
+        ch = c->sibling;
+      }
+      src = buf;
+      break;
+    }
+    default: panic("GPU: invalid canvas type %d at 0x%x", cv.type, off);
+  }
+  blit(dst, W, H, src, w, h, cv.x1, cv.y1, cv.w1, cv.h1);
+  scratch_top = old_top;
+}
+
+static void gpu_exec_cmd() {
+  uint32_t *r = vgactl_port_base;
+  switch (r[reg_cmd]) {
+    case GPU_CMD_MEMCPY: gpu_memcpy(r[reg_arg0], r[reg_arg1], r[reg_arg2]); break;
+    case GPU_CMD_RENDER:
+      scratch_top = 0;
+      render(r[reg_arg0], vmem, screen_width(), screen_height(), 0);
+      break;
+    default: panic("GPU: unknown command %d", r[reg_cmd]);
+  }
+  r[reg_cmd] = 0;
+}
+
+static void init_accel() {
+  tmem = malloc(CONFIG_VGA_TMEM_SIZE);
+  scratch = malloc(SCRATCH_LEN * sizeof(uint32_t));
+  assert(tmem && scratch);
+  add_snapshot_state("tmem", tmem, CONFIG_VGA_TMEM_SIZE);
+  vgactl_port_base[reg_tmem_size] = CONFIG_VGA_TMEM_SIZE;
 }
 #endif
+
+#ifndef CONFIG_TARGET_AM
+static void vga_io_handler(uint32_t offset, int len, bool is_write) {
+  if (!is_write) return;
+  if (capture_fp != NULL && offset == reg_sync * 4 && vgactl_port_base[reg_sync] != 0) {
+    capture_frame();
+    vgactl_port_base[reg_sync] = 0;
+  }
+  IFDEF(CONFIG_VGA_ACCEL, if (offset == reg_cmd * 4) gpu_exec_cmd());
+}
+#else
+#define capture_fp NULL
+#define vga_io_handler NULL
 #endif
 
 void vga_update_screen() {
-  // TODO: call `update_screen()` when the sync register is non-zero,
-  // then zero out the sync register
+  if (capture_fp != NULL) return;
+  if (vgactl_port_base[1] != 0) {
+    IFDEF(CONFIG_VGA_SHOW_SCREEN, MUXDEF(CONFIG_DEVICE_THREAD, publish_frame(), update_screen(vmem)));
+    vgactl_port_base[1] = 0;
+  }
 }
 
 void init_vga() {
-  vgactl_port_base = (uint32_t *)new_space(8);
+  vgactl_port_base = (uint32_t *)new_space(VGACTL_SIZE);
   vgactl_port_base[0] = (screen_width() << 16) | screen_height();
 #ifdef CONFIG_HAS_PORT_IO
-  add_pio_map ("vgactl", CONFIG_VGA_CTL_PORT, vgactl_port_base, 8, NULL);
+  add_pio_map ("vgactl", CONFIG_VGA_CTL_PORT, vgactl_port_base, VGACTL_SIZE, vga_io_handler);
 #else
-  add_mmio_map("vgactl", CONFIG_VGA_CTL_MMIO, vgactl_port_base, 8, NULL);
+  add_mmio_map("vgactl", CONFIG_VGA_CTL_MMIO, vgactl_port_base, VGACTL_SIZE, vga_io_handler);
 #endif
+  IFDEF(CONFIG_VGA_ACCEL, init_accel());
 
   vmem = new_space(screen_size());
   add_mmio_map("vmem", CONFIG_FB_ADDR, vmem, screen_size(), NULL);
-  IFDEF(CONFIG_VGA_SHOW_SCREEN, init_screen());
-  IFDEF(CONFIG_VGA_SHOW_SCREEN, memset(vmem, 0, screen_size()));
+  memset(vmem, 0, screen_size());
+  if (capture_fp == NULL) {
+    // with the device thread, the window is created by vga_thread_init()
+    IFDEF(CONFIG_VGA_SHOW_SCREEN, IFNDEF(CONFIG_DEVICE_THREAD, init_screen()));
+  } else {
+    Log("VGA runs headless, frames are captured on every sync");
+  }
 }
+
+#ifdef CONFIG_DEVICE_THREAD
+// called by the device thread, SDL requires the window to be created
+// by the thread which renders to it and polls its events
+void vga_thread_init() {
+#ifdef CONFIG_VGA_SHOW_SCREEN
+  if (capture_fp != NULL) return;
+  for (int i = 0; i < 3; i ++) {
+    frame[i] = calloc(1, screen_size());
+    assert(frame[i]);
+  }
+  init_screen();
+#endif
+}
+#endif
@@ -20,6 +20,8 @@
 
 void set_nemu_state(int state, vaddr_t pc, int halt_ret) {
   difftest_skip_ref();
+  // a mismatch found by a batch of difftest has already stopped NEMU
+  if (nemu_state.state == NEMU_ABORT) return;
   nemu_state.state = state;
   nemu_state.halt_pc = pc;
   nemu_state.halt_ret = halt_ret;
@@ -49,3 +51,143 @@ void invalid_inst(vaddr_t thispc) {
 
   set_nemu_state(NEMU_ABORT, thispc, -1);
 }
+
+#ifdef CONFIG_HOSTCALL
+#include <hostcall-def.h>
+#include <device/map.h>
+#include <device/idle.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/syscall.h>
+#include <linux/openat2.h>
+
+// guest fds are translated, so that the guest can only use the files it
+// opens and the standard streams of NEMU
+#define NR_HOST_FD 32
+static int host_fd[NR_HOST_FD] = { 0, 1, 2, [3 ... NR_HOST_FD - 1] = -1 };
+
+// The guest opens files only under the directory given by --hostcall-root,
+// and nothing at all without it. Paths are resolved by openat2() as if the
+// directory were the root, so neither "..", absolute paths nor symlinks
+// get out of it.
+static int root_fd = -1;
+
+static int open_in_root(const char *path, int flags, mode_t mode) {
+  struct open_how how = { .flags = flags, .mode = (flags & O_CREAT ? mode : 0),
+    .resolve = RESOLVE_IN_ROOT | RESOLVE_NO_MAGICLINKS };
+  return syscall(SYS_openat2, root_fd, path, &how, sizeof(how));
+}
+
+void hostcall_set_root(const char *dir) {
+  root_fd = open(dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  Assert(root_fd >= 0, "Can not open the hostcall root %s: %s", dir, strerror(errno));
+  int fd = open_in_root(".", O_RDONLY | O_DIRECTORY, 0);
+  Assert(fd >= 0, "openat2() is required to confine hostcalls: %s", strerror(errno));
+  close(fd);
+  Log("Guest files of hostcalls are under %s", dir);
+}
+
+static int get_host_fd(word_t fd) {
+  return (fd < NR_HOST_FD ? host_fd[fd] : -1);
+}
+
+static char* guest_str(paddr_t addr) {
+  uint8_t *p = dma_guest_ptr(addr, 1);
+  if (p == NULL) return NULL;
+  // the string must be terminated inside pmem
+  size_t max = CONFIG_MBASE + CONFIG_MSIZE - addr;
+  return (memchr(p, '\0', max) ? (char *)p : NULL);
+}
+
+static word_t hc_open(word_t path, word_t flags, word_t mode) {
+  if (root_fd < 0) return -EACCES;
+  char *p = guest_str(path);
+  if (p == NULL) return -EFAULT;
+  int fd;
+  for (fd = 0; fd < NR_HOST_FD && host_fd[fd] != -1; fd ++);
+  if (fd == NR_HOST_FD) return -EMFILE;
+
+  int oflags = (flags & HOSTCALL_O_WRONLY ? O_WRONLY : 0) |
+    (flags & HOSTCALL_O_RDWR ? O_RDWR : 0) |
+    (flags & HOSTCALL_O_CREAT ? O_CREAT : 0) |
+    (flags & HOSTCALL_O_TRUNC ? O_TRUNC : 0) |
+    (flags & HOSTCALL_O_APPEND ? O_APPEND : 0);
+  int ret = open_in_root(p, oflags | O_CLOEXEC, mode);
+  if (ret < 0) return -errno;
+  host_fd[fd] = ret;
+  return fd;
+}
+
+static word_t hc_close(word_t fd) {
+  int hfd = get_host_fd(fd);
+  if (hfd < 0) return -EBADF;
+  // the standard streams are shared with NEMU, never close them
+  if (hfd > 2 && close(hfd) != 0) return -errno;
+  host_fd[fd] = -1;
+  return 0;
+}
+
+static word_t hc_read(word_t fd, paddr_t addr, word_t len) {
+  int hfd = get_host_fd(fd);
+  if (hfd < 0) return -EBADF;
+  uint8_t *buf = dma_guest_ptr(addr, len);
+  if (buf == NULL) return -EFAULT;
+  ssize_t n = read(hfd, buf, len);
+  if (n < 0) return -errno;
+  dma_guest_written(addr, n);
+  return n;
+}
+
+static word_t hc_write(word_t fd, paddr_t addr, word_t len) {
+  int hfd = get_host_fd(fd);
+  if (hfd < 0) return -EBADF;
+  uint8_t *buf = dma_guest_ptr(addr, len);
+  if (buf == NULL) return -EFAULT;
+  if (hfd == 1) fflush(stdout);
+  ssize_t n = write(hfd, buf, len);
+  return (n < 0 ? -errno : n);
+}
+
+static word_t hc_lseek(word_t fd, sword_t offset, word_t whence) {
+  int hfd = get_host_fd(fd);
+  if (hfd < 0) return -EBADF;
+  if (whence != SEEK_SET && whence != SEEK_CUR && whence != SEEK_END) return -EINVAL;
+  off_t ret = lseek(hfd, offset, whence);
+  return (ret < 0 ? -errno : ret);
+}
+
+static word_t hc_memcpy(paddr_t dst, paddr_t src, word_t len) {
+  uint8_t *d = dma_guest_ptr(dst, len);
+  uint8_t *s = dma_guest_ptr(src, len);
+  if (d == NULL || s == NULL) return -EFAULT;
+  memmove(d, s, len);
+  dma_guest_written(dst, len);
+  return 0;
+}
+
+// `args` points to a0-a7 of the guest, see hostcall-def.h for the ABI
+void hostcall(word_t *args) {
+  // the reference knows nothing about hostcalls, take the registers from
+  // NEMU, and memory written by the service is copied by dma_guest_written()
+  difftest_skip_ref();
+
+  word_t *a = args;
+  switch (a[0]) {
+    case HOSTCALL_OPEN:   a[0] = hc_open(a[1], a[2], a[3]); break;
+    case HOSTCALL_CLOSE:  a[0] = hc_close(a[1]); break;
+    case HOSTCALL_READ:   a[0] = hc_read(a[1], a[2], a[3]); break;
+    case HOSTCALL_WRITE:  a[0] = hc_write(a[1], a[2], a[3]); break;
+    case HOSTCALL_LSEEK:  a[0] = hc_lseek(a[1], a[2], a[3]); break;
+    case HOSTCALL_MEMCPY: a[0] = hc_memcpy(a[1], a[2], a[3]); break;
+    case HOSTCALL_TIME: {
+      // the same clock as the RTC, which runs ahead of the host in warp mode
+      uint64_t us = get_guest_time();
+      a[0] = us;
+      a[1] = us >> 32;
+      break;
+    }
+    default: a[0] = -ENOSYS; break;
+  }
+}
+#endif
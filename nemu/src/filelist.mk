@@ -18,8 +18,23 @@ DIRS-y += src/cpu src/monitor src/utils
 DIRS-$(CONFIG_MODE_SYSTEM) += src/memory
 DIRS-BLACKLIST-$(CONFIG_TARGET_AM) += src/monitor/sdb
 
+ifndef CONFIG_HLE
+SRCS-BLACKLIST-y += src/cpu/hle.c
+endif
+
+ifndef CONFIG_SNAPSHOT
+SRCS-BLACKLIST-y += src/monitor/snapshot.c
+endif
+
+ifndef CONFIG_CHECKPOINT
+SRCS-BLACKLIST-y += src/monitor/sdb/checkpoint.c
+endif
+
 SHARE = $(if $(CONFIG_TARGET_SHARE),1,0)
 LIBS += $(if $(CONFIG_TARGET_NATIVE_ELF),-lreadline -ldl -pie,)
+LIBS += $(if $(CONFIG_TARGET_SHARE),-lreadline,)
+LIBS += $(if $(CONFIG_DIFFTEST_MODE_PIPELINE),-lpthread,)
+LIBS += $(if $(CONFIG_SNAPSHOT),-lz -lpthread,)
 
 ifdef mainargs
 ASFLAGS += -DBIN_PATH=\"$(mainargs)\"
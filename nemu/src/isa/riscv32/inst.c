@@ -17,11 +17,23 @@
 #include <cpu/cpu.h>
 #include <cpu/ifetch.h>
 #include <cpu/decode.h>
+#include <device/idle.h>
 
 #define R(i) gpr(i)
 #define Mr vaddr_read
 #define Mw vaddr_write
 
+#ifdef CONFIG_HOSTCALL
+#include <hostcall-def.h>
+// ebreak with a7 = HOSTCALL_MAGIC is a hostcall, pass a0-a7 to it
+#define EBREAK(pc) do { \
+  if (R(17) == HOSTCALL_MAGIC) hostcall(&R(10)); \
+  else NEMUTRAP(pc, R(10)); \
+} while (0)
+#else
+#define EBREAK(pc) NEMUTRAP(pc, R(10))
+#endif
+
 enum {
   TYPE_I, TYPE_U, TYPE_S,
   TYPE_N, // none
@@ -63,7 +75,8 @@ static int decode_exec(Decode *s) {
   INSTPAT("??????? ????? ????? 100 ????? 00000 11", lbu    , I, R(rd) = Mr(src1 + imm, 1));
   INSTPAT("??????? ????? ????? 000 ????? 01000 11", sb     , S, Mw(src1 + imm, 1, src2));
 
-  INSTPAT("0000000 00001 00000 000 00000 11100 11", ebreak , N, NEMUTRAP(s->pc, R(10))); // R(10) is $a0
+  INSTPAT("0000000 00001 00000 000 00000 11100 11", ebreak , N, EBREAK(s->pc)); // R(10) is $a0
+  INSTPAT("0001000 00101 00000 000 00000 11100 11", wfi    , N, idle_wfi());
   INSTPAT("??????? ????? ????? ??? ????? ????? ??", inv    , N, INV(s->pc));
   INSTPAT_END();
 
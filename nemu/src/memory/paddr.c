@@ -15,8 +15,12 @@
 
 #include <memory/host.h>
 #include <memory/paddr.h>
+#include <memory/vaddr.h>
 #include <device/mmio.h>
+#include <device/idle.h>
 #include <isa.h>
+#include <cpu/difftest.h>
+#include <snapshot.h>
 
 #if   defined(CONFIG_PMEM_MALLOC)
 static uint8_t *pmem = NULL;
@@ -33,6 +37,9 @@ static word_t pmem_read(paddr_t addr, int len) {
 }
 
 static void pmem_write(paddr_t addr, int len, word_t data) {
+  IFDEF(CONFIG_DIFFTEST_MODE_BATCH, difftest_journal(addr, len));
+  IFDEF(CONFIG_DIFFTEST_MEMCHK, difftest_mark_dirty(addr, len));
+  IFDEF(CONFIG_SNAPSHOT, snapshot_mark_dirty(addr, len));
   host_write(guest_to_host(addr), len, data);
 }
 
@@ -52,13 +59,21 @@ void init_mem() {
 
 word_t paddr_read(paddr_t addr, int len) {
   if (likely(in_pmem(addr))) return pmem_read(addr, len);
+#ifdef CONFIG_HAS_PVCLOCK
+  word_t pvclock_read(paddr_t addr, int len);
+  // a read across the end of the page takes the slow path, which checks it
+  if (addr - CONFIG_PVCLOCK_ADDR <= PAGE_SIZE - len) return pvclock_read(addr, len);
+#endif
   IFDEF(CONFIG_DEVICE, return mmio_read(addr, len));
+  IFDEF(CONFIG_TARGET_SHARE, return difftest_mmio_read(addr, len));
   out_of_bound(addr);
   return 0;
 }
 
 void paddr_write(paddr_t addr, int len, word_t data) {
+  IFDEF(CONFIG_IDLE_DETECT, idle_write(addr));
   if (likely(in_pmem(addr))) { pmem_write(addr, len, data); return; }
   IFDEF(CONFIG_DEVICE, mmio_write(addr, len, data); return);
+  IFDEF(CONFIG_TARGET_SHARE, return); // REF has no devices, see difftest_mmio()
   out_of_bound(addr);
 }
@@ -23,6 +23,8 @@ void init_difftest(char *ref_so_file, long img_size, int port);
 void init_device();
 void init_sdb();
 void init_disasm();
+void init_hle(const char *elf_file);
+void init_snapshot(const char *restore_file, char *save_spec);
 
 static void welcome() {
   Log("Trace: %s", MUXDEF(CONFIG_TRACE, ANSI_FMT("ON", ANSI_FG_GREEN), ANSI_FMT("OFF", ANSI_FG_RED)));
@@ -40,11 +42,21 @@ static void welcome() {
 #include <getopt.h>
 
 void sdb_set_batch_mode();
+void vga_set_capture(const char *spec);
+void audio_set_capture(const char *spec);
+void disk_set_overlay(const char *file);
+void sdcard_set_overlay(const char *file);
+void net_set_backend(char *spec);
+void idle_set_mode(const char *mode);
+void hostcall_set_root(const char *dir);
 
 static char *log_file = NULL;
 static char *diff_so_file = NULL;
 static char *img_file = NULL;
+static char *elf_file = NULL;
 static int difftest_port = 1234;
+static char *restore_file = NULL;
+static char *save_spec = NULL;
 
 static long load_img() {
   if (img_file == NULL) {
@@ -75,6 +87,16 @@ static int parse_args(int argc, char *argv[]) {
     {"diff"     , required_argument, NULL, 'd'},
     {"port"     , required_argument, NULL, 'p'},
     {"help"     , no_argument      , NULL, 'h'},
+    {"vga-capture", required_argument, NULL, 'V'},
+    {"audio-capture", required_argument, NULL, 'A'},
+    {"disk-overlay", required_argument, NULL, 'D'},
+    {"sdcard-overlay", required_argument, NULL, 'S'},
+    {"net"      , required_argument, NULL, 'N'},
+    {"elf"      , required_argument, NULL, 'E'},
+    {"idle"     , required_argument, NULL, 'I'},
+    {"restore"  , required_argument, NULL, 'R'},
+    {"save-at"  , required_argument, NULL, 'T'},
+    {"hostcall-root", required_argument, NULL, 'H'},
     {0          , 0                , NULL,  0 },
   };
   int o;
@@ -84,6 +106,16 @@ static int parse_args(int argc, char *argv[]) {
       case 'p': sscanf(optarg, "%d", &difftest_port); break;
       case 'l': log_file = optarg; break;
       case 'd': diff_so_file = optarg; break;
+      case 'V': MUXDEF(CONFIG_HAS_VGA, vga_set_capture(optarg), panic("VGA is not enabled")); break;
+      case 'A': MUXDEF(CONFIG_HAS_AUDIO, audio_set_capture(optarg), panic("audio is not enabled")); break;
+      case 'D': MUXDEF(CONFIG_HAS_DISK, disk_set_overlay(optarg), panic("disk is not enabled")); break;
+      case 'S': MUXDEF(CONFIG_HAS_SDCARD, sdcard_set_overlay(optarg), panic("sdcard is not enabled")); break;
+      case 'N': MUXDEF(CONFIG_HAS_NET, net_set_backend(optarg), panic("network card is not enabled")); break;
+      case 'E': elf_file = optarg; break;
+      case 'I': MUXDEF(CONFIG_IDLE_DETECT, idle_set_mode(optarg), panic("idle detection is not enabled")); break;
+      case 'R': restore_file = optarg; break;
+      case 'T': save_spec = optarg; break;
+      case 'H': MUXDEF(CONFIG_HOSTCALL, hostcall_set_root(optarg), panic("hostcalls are not enabled")); break;
       case 1: img_file = optarg; return 0;
       default:
         printf("Usage: %s [OPTION...] IMAGE [args]\n\n", argv[0]);
@@ -91,6 +123,20 @@ static int parse_args(int argc, char *argv[]) {
         printf("\t-l,--log=FILE           output log to FILE\n");
         printf("\t-d,--diff=REF_SO        run DiffTest with reference REF_SO\n");
         printf("\t-p,--port=PORT          run DiffTest with port PORT\n");
+        printf("\t   --vga-capture=FMT:FILE  run VGA headless and dump every frame to FILE,\n");
+        printf("\t                           FMT is one of raw, ppm and hash\n");
+        printf("\t   --audio-capture=MODE:FILE  play audio into a WAV FILE instead of SDL,\n");
+        printf("\t                           MODE is wav (as fast as possible) or wav-rt (real time)\n");
+        printf("\t   --disk-overlay=FILE     keep the disk image read-only and write to the overlay FILE\n");
+        printf("\t   --sdcard-overlay=FILE   keep the sdcard image read-only and write to the overlay FILE\n");
+        printf("\t   --net=unix:LOCAL:PEER   connect the network card to the datagram socket PEER\n");
+        printf("\t   --net=pcap:OUT[:IN]     record sent packets to OUT and replay packets from IN\n");
+        printf("\t   --elf=FILE              read symbols of the image from the ELF FILE\n");
+        printf("\t   --idle=MODE             handle idle loops of the guest with MODE,\n");
+        printf("\t                           which is one of off, sleep (default) and warp\n");
+        printf("\t   --restore=FILE          restore the machine from the snapshot FILE\n");
+        printf("\t   --save-at=N:FILE        save a snapshot to FILE after N instructions\n");
+        printf("\t   --hostcall-root=DIR     let the guest open host files under DIR with hostcalls\n");
         printf("\n");
         exit(0);
     }
@@ -122,9 +168,16 @@ void init_monitor(int argc, char *argv[]) {
   /* Load the image to memory. This will overwrite the built-in image. */
   long img_size = load_img();
 
+  /* Hook well-known functions of the image. */
+  IFDEF(CONFIG_HLE, init_hle(elf_file));
+
   /* Initialize differential testing. */
   init_difftest(diff_so_file, img_size, difftest_port);
 
+  /* Restore or schedule snapshots, after everything to restore is initialized. */
+  IFDEF(CONFIG_SNAPSHOT, init_snapshot(restore_file, save_spec));
+  IFNDEF(CONFIG_SNAPSHOT, Assert(restore_file == NULL && save_spec == NULL, "snapshot is not enabled"));
+
   /* Initialize the simple debugger. */
   init_sdb();
 
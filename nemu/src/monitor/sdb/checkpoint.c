@@ -0,0 +1,335 @@
+/***************************************************************************************
+* Copyright (c) 2014-2024 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+#include <isa.h>
+#include <cpu/cpu.h>
+#include <checkpoint.h>
+#include <snapshot.h>
+#include <poll.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/prctl.h>
+#include <sys/wait.h>
+#include "sdb.h"
+
+// Reverse execution with fork-based checkpoints.
+//
+// Every CONFIG_CHECKPOINT_INTERVAL instructions the running process forks,
+// and the child becomes a checkpoint: it keeps a copy-on-write image of the
+// whole machine and waits for commands on a pipe. To go back in time, the
+// nearest checkpoint before the target forks again, the new process runs
+// forward to the target and takes over the sdb prompt, and the old process
+// exits. A checkpoint is not used up by resuming it.
+//
+// The process started by the user stays alive to keep the terminal. After
+// it hands over, it only reaps the others as their subreaper, and exits
+// with the status of the last running process. Checkpoints exit when it
+// exits, which they see from the lifeline pipe.
+
+extern uint64_t g_nr_guest_inst;
+
+typedef struct {
+  pid_t pid;
+  uint64_t nr_inst;
+  int fd; // write end of the command pipe
+} Checkpoint;
+
+// checkpoints of the current timeline, the oldest one first
+static Checkpoint cp[CONFIG_CHECKPOINT_MAX];
+static int nr_cp = 0;
+static uint64_t next_at = UINT64_MAX;
+
+enum { CMD_EXIT, CMD_GOTO, CMD_SEARCH };
+
+// followed by `nr_wp` watchpoints, each of which is its number,
+// the length of its expression and the expression
+typedef struct {
+  uint32_t type;
+  uint32_t nr_wp;
+  uint64_t target;
+} Command;
+
+// the last command received, which a resumed checkpoint carries out
+static Command cmd = {};
+static CNT_TYPE wp_no[NR_WP];
+static char *wp_expr[NR_WP] = {};
+static bool replaying = false;
+
+static struct {
+  pid_t origin; // the process started by the user
+  pid_t active; // the process running the machine, 0 during a handover
+} *session = NULL;
+static int lifeline[2] = {-1, -1};
+
+sigjmp_buf checkpoint_resume_point;
+
+static bool write_all(int fd, const void *buf, size_t len) {
+  for (const char *p = buf; len > 0; ) {
+    ssize_t n = write(fd, p, len);
+    if (n < 0 && errno == EINTR) continue;
+    if (n <= 0) return false;
+    p += n;
+    len -= n;
+  }
+  return true;
+}
+
+static bool read_all(int fd, void *buf, size_t len) {
+  for (char *p = buf; len > 0; ) {
+    ssize_t n = read(fd, p, len);
+    if (n < 0 && errno == EINTR) continue;
+    if (n <= 0) return false;
+    p += n;
+    len -= n;
+  }
+  return true;
+}
+
+// fails if the checkpoint is gone, since SIGPIPE is ignored
+static bool send_command(Checkpoint *c, uint32_t type, uint64_t target) {
+  Command hdr = { .type = type, .nr_wp = 0, .target = target };
+  WP *wp;
+  if (type != CMD_EXIT) {
+    for (wp = used_wp(); wp != NULL; wp = wp->next) { hdr.nr_wp ++; }
+  }
+  bool ok = write_all(c->fd, &hdr, sizeof(hdr));
+  for (wp = used_wp(); ok && hdr.nr_wp > 0 && wp != NULL; wp = wp->next) {
+    uint32_t len = strlen(wp->expr_str);
+    ok = write_all(c->fd, &wp->NO, sizeof(wp->NO)) &&
+         write_all(c->fd, &len, sizeof(len)) &&
+         write_all(c->fd, wp->expr_str, len);
+  }
+  return ok;
+}
+
+static bool recv_command(int fd) {
+  if (!read_all(fd, &cmd, sizeof(cmd))) return false;
+  Assert(cmd.nr_wp <= NR_WP, "bad checkpoint command");
+  for (int i = 0; i < cmd.nr_wp; i ++) {
+    uint32_t len;
+    if (!read_all(fd, &wp_no[i], sizeof(wp_no[i])) || !read_all(fd, &len, sizeof(len))) return false;
+    free(wp_expr[i]);
+    wp_expr[i] = malloc(len + 1);
+    if (!read_all(fd, wp_expr[i], len)) return false;
+    wp_expr[i][len] = '\0';
+  }
+  return true;
+}
+
+static void drop(int i) {
+  send_command(&cp[i], CMD_EXIT, 0);
+  close(cp[i].fd);
+  nr_cp --;
+  memmove(&cp[i], &cp[i + 1], sizeof(cp[0]) * (nr_cp - i));
+}
+
+// The checkpoint waits here. It returns only in the new process which
+// resumes the checkpoint, when the checkpoint itself keeps waiting.
+static void checkpoint_wait(int rfd, int wfd) {
+  pid_t self = getpid();
+  while (true) {
+    struct pollfd pfd[2] = {
+      { .fd = rfd, .events = POLLIN },
+      { .fd = lifeline[0], .events = POLLIN },
+    };
+    if (poll(pfd, 2, -1) < 0) continue;
+    if (pfd[1].revents != 0) _exit(0);
+    if (!recv_command(rfd) || cmd.type == CMD_EXIT) _exit(0);
+
+    pid_t pid = fork();
+    if (pid == 0) {
+      // fork again to leave the new process to the origin to reap
+      if (fork() != 0) _exit(0);
+      session->active = getpid();
+      close(rfd);
+      cp[nr_cp ++] = (Checkpoint){ .pid = self, .nr_inst = g_nr_guest_inst, .fd = wfd };
+      return;
+    }
+    if (pid > 0) waitpid(pid, NULL, 0);
+  }
+}
+
+uint64_t checkpoint_next() {
+  return next_at;
+}
+
+void checkpoint_take() {
+  if (g_nr_guest_inst < next_at) return;
+  next_at = g_nr_guest_inst + CONFIG_CHECKPOINT_INTERVAL;
+  // those taken while searching for a watchpoint would be dropped soon
+  if (replaying && cmd.type == CMD_SEARCH) return;
+
+  while (waitpid(-1, NULL, WNOHANG) > 0); // reap dropped checkpoints
+  if (nr_cp == CONFIG_CHECKPOINT_MAX) drop(0);
+
+  int fd[2];
+  if (pipe(fd) != 0) {
+    Log("Can not take a checkpoint: %s", strerror(errno));
+    return;
+  }
+  fflush(stdout);
+  pid_t pid = fork();
+  if (pid == 0) {
+    if (lifeline[1] >= 0) {
+      close(lifeline[1]);
+      lifeline[1] = -1;
+    }
+    checkpoint_wait(fd[0], fd[1]);
+    siglongjmp(checkpoint_resume_point, 1);
+  }
+  close(fd[0]);
+  if (pid < 0) {
+    close(fd[1]);
+    Log("Can not take a checkpoint: %s", strerror(errno));
+    return;
+  }
+  cp[nr_cp ++] = (Checkpoint){ .pid = pid, .nr_inst = g_nr_guest_inst, .fd = fd[1] };
+}
+
+// Hand the machine over to checkpoint `i`, which carries out the command.
+// This returns only if the checkpoint is gone.
+static void resume(int i, uint32_t type, uint64_t target) {
+  // the snapshot being written is lost if this process exits
+  IFDEF(CONFIG_SNAPSHOT, snapshot_wait());
+  fflush(stdout);
+  session->active = 0;
+  if (!send_command(&cp[i], type, target)) {
+    session->active = getpid();
+    drop(i);
+    return;
+  }
+  // the checkpoints after it belong to a future which is thrown away
+  for (int j = i + 1; j < nr_cp; j ++) {
+    send_command(&cp[j], CMD_EXIT, 0);
+  }
+  if (getpid() != session->origin) _exit(0);
+
+  while (true) {
+    int status;
+    pid_t pid = waitpid(-1, &status, 0);
+    if (pid < 0 && errno == ECHILD) _exit(EXIT_FAILURE);
+    if (pid > 0 && pid == session->active) {
+      _exit(WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status));
+    }
+  }
+}
+
+// resume the newest checkpoint at or before instruction `at`,
+// return if there is none
+static void go_back(uint64_t at, uint32_t type, uint64_t target) {
+  for (int i = nr_cp - 1; i >= 0; i --) {
+    if (cp[i].nr_inst <= at) {
+      resume(i, type, target);
+      i = nr_cp; // it is gone, look again
+    }
+  }
+}
+
+// run forward to instruction `target`, and return the last instruction
+// before it which triggers a watchpoint, or 0 if there is none
+static uint64_t run_to(uint64_t target) {
+  uint64_t hit = 0;
+  while (g_nr_guest_inst < target) {
+    cpu_exec(target - g_nr_guest_inst);
+    if (nemu_state.state != NEMU_STOP) break;
+    if (g_nr_guest_inst < target) hit = g_nr_guest_inst;
+  }
+  return hit;
+}
+
+void checkpoint_replay() {
+  // the watchpoints may be set after the checkpoint is taken
+  free_all_wp();
+  for (int i = 0; i < cmd.nr_wp; i ++) {
+    restore_wp(wp_no[i], wp_expr[i]);
+  }
+  nemu_state.state = NEMU_STOP;
+
+  replaying = true;
+  // run one more instruction, so that a watchpoint triggered
+  // by the last one can be told apart from the end of the run
+  uint64_t end = cmd.target + (cmd.type == CMD_SEARCH);
+  uint64_t hit = run_to(end);
+  replaying = false;
+  if (g_nr_guest_inst != end) {
+    printf("The replay stops at instruction %" PRIu64 " before reaching %" PRIu64 ".\n",
+        g_nr_guest_inst, end);
+    return;
+  }
+
+  if (cmd.type == CMD_GOTO) {
+    printf("Back at instruction %" PRIu64 ", pc = " FMT_WORD "\n", g_nr_guest_inst, cpu.pc);
+    return;
+  }
+
+  // searching, the checkpoint resumed is the newest one
+  uint64_t start = cp[nr_cp - 1].nr_inst;
+  if (hit != 0) {
+    go_back(hit, CMD_GOTO, hit);
+  } else {
+    if (start > 0) go_back(start - 1, CMD_SEARCH, start);
+    printf("No watchpoint is triggered after the oldest checkpoint.\n");
+    go_back(start, CMD_GOTO, start);
+  }
+  printf("The checkpoint at instruction %" PRIu64 " is gone.\n", start);
+}
+
+bool checkpoint_replaying() {
+  return replaying;
+}
+
+void checkpoint_reverse_step(uint64_t n) {
+  if (n > g_nr_guest_inst) {
+    printf("Only %" PRIu64 " instructions are executed.\n", g_nr_guest_inst);
+    return;
+  }
+  uint64_t target = g_nr_guest_inst - n;
+  go_back(target, CMD_GOTO, target);
+  printf("No checkpoint at or before instruction %" PRIu64 ".\n", target);
+}
+
+void checkpoint_reverse_continue() {
+  if (g_nr_guest_inst == 0) {
+    printf("No instruction is executed.\n");
+    return;
+  }
+  // the watchpoint triggered by the last instruction, if any, is where
+  // the machine stops now, so search before it
+  uint64_t end = g_nr_guest_inst - 1;
+  go_back(end, CMD_SEARCH, end);
+  printf("No checkpoint at or before instruction %" PRIu64 ".\n", end);
+}
+
+// drop all checkpoints, since the machine is replaced by a snapshot
+void checkpoint_reset() {
+  while (nr_cp > 0) {
+    drop(nr_cp - 1);
+  }
+  next_at = g_nr_guest_inst;
+}
+
+void init_checkpoint() {
+  session = mmap(NULL, sizeof(*session), PROT_READ | PROT_WRITE,
+      MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+  Assert(session != MAP_FAILED, "Can not map the checkpoint session: %s", strerror(errno));
+  session->origin = session->active = getpid();
+  Assert(pipe(lifeline) == 0, "Can not create the lifeline of checkpoints: %s", strerror(errno));
+  prctl(PR_SET_CHILD_SUBREAPER, 1);
+  signal(SIGPIPE, SIG_IGN);
+  next_at = g_nr_guest_inst;
+  Log("Take a checkpoint every %d instructions for reverse execution, keep at most %d",
+      CONFIG_CHECKPOINT_INTERVAL, CONFIG_CHECKPOINT_MAX);
+}
@@ -18,6 +18,8 @@
 #include <readline/readline.h>
 #include <readline/history.h>
 #include <memory/paddr.h>
+#include <snapshot.h>
+#include <checkpoint.h>
 #include "sdb.h"
 
 static int is_batch_mode = false;
@@ -357,6 +359,55 @@ static int cmd_d(char *args) {
   return 0;
 }
 
+#ifdef CONFIG_SNAPSHOT
+/* save FILE */
+static int cmd_save(char *args) {
+  char *file = (args == NULL ? NULL : strtok(args, delimiter));
+  if (file == NULL) {
+    printf("Argument required (snapshot file).\n");
+    return 0;
+  }
+  snapshot_save(file);
+  return 0;
+}
+
+/* load FILE */
+static int cmd_load(char *args) {
+  char *file = (args == NULL ? NULL : strtok(args, delimiter));
+  if (file == NULL) {
+    printf("Argument required (snapshot file).\n");
+    return 0;
+  }
+  if (snapshot_load(file)) {
+    IFDEF(CONFIG_CHECKPOINT, checkpoint_reset());
+  }
+  return 0;
+}
+#endif
+
+#ifdef CONFIG_CHECKPOINT
+/* reverse-step [N] */
+static int cmd_reverse_step(char *args) {
+  char *arg = (args == NULL ? NULL : strtok(args, delimiter));
+  uint64_t num = 1;
+  if (arg != NULL) {
+    bool success = false;
+    num = str_to_num(arg, &success);
+    if (!success) {
+      return 0;
+    }
+  }
+  checkpoint_reverse_step(num);
+  return 0;
+}
+
+/* reverse-continue */
+static int cmd_reverse_continue(char *args) {
+  checkpoint_reverse_continue();
+  return 0;
+}
+#endif
+
 static int cmd_help(char *args);
 
 static struct {
@@ -373,6 +424,14 @@ static struct {
   { "p", "Evaluate expression.", cmd_p },
   { "w", "Set up monitoring points.", cmd_w },
   { "d", "Delete monitoring points.", cmd_d },
+#ifdef CONFIG_SNAPSHOT
+  { "save", "Save a snapshot of the whole machine to a file.", cmd_save },
+  { "load", "Restore the whole machine from a snapshot file.", cmd_load },
+#endif
+#ifdef CONFIG_CHECKPOINT
+  { "reverse-step", "Step back N instructions.", cmd_reverse_step },
+  { "reverse-continue", "Run backward to the last change of a watchpoint.", cmd_reverse_continue },
+#endif
   /* TODO: Add more commands */
 };
 
@@ -411,6 +470,14 @@ void sdb_mainloop() {
     return;
   }
 
+#ifdef CONFIG_CHECKPOINT
+  init_checkpoint();
+  // a resumed checkpoint comes back here and runs forward to its target
+  if (sigsetjmp(checkpoint_resume_point, 0) != 0) {
+    checkpoint_replay();
+  }
+#endif
+
   char str_bak[MAX_TOKEN_NUM + 1] = {0};
   for (char *str; (str = rl_gets()) != NULL;) {
     if (*str == '\0') {
@@ -47,6 +47,8 @@ void free_all_wp();
 void free_wp_by_num(uint32_t num);
 
 WP *find_wp(uint32_t num);
+WP *used_wp();
+void restore_wp(CNT_TYPE no, char *e);
 
 void display_all_wp();
 
@@ -39,8 +39,9 @@ void init_wp_pool() {
 
 /* Implement the functionality of watchpoint */
 
+static CNT_TYPE cnt = 0;
+
 static CNT_TYPE add_cnt() {
-  static CNT_TYPE cnt = 0;
   cnt++;
   return cnt;
 }
@@ -176,6 +177,26 @@ void display_all_wp() {
   }
 }
 
+WP *used_wp() {
+  return used_head;
+}
+
+/* 以编号no重建监视点, 用于恢复检查点时接过sdb的监视点 */
+void restore_wp(CNT_TYPE no, char *e) {
+  WP *wp = new_wp();
+  if (wp == NULL) {
+    return;
+  }
+
+  bool success;
+  wp->NO = no;
+  strcpy(wp->expr_str, e);
+  wp->old_value = expr(e, &success);
+  if (cnt < no) {
+    cnt = no;
+  }
+}
+
 void scan_all_wp(bool *stop) {
   *stop = false;
   for (WP* item = used_head; item; item = item->next) {
@@ -0,0 +1,475 @@
+/***************************************************************************************
+* Copyright (c) 2014-2024 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+#include <isa.h>
+#include <cpu/difftest.h>
+#include <memory/paddr.h>
+#include <memory/vaddr.h>
+#include <snapshot.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <zlib.h>
+
+extern uint64_t g_nr_guest_inst;
+
+// A snapshot file is laid out as
+//
+//   SnapHeader
+//   registered states, each as a StateRecord followed by the state,
+//   compressed as a whole
+//   compressed pages, then raw pages aligned to PAGE_SIZE
+//   a PageEntry for each stored page
+//
+// A snapshot without a base stores the non-zero pages of pmem. Once a
+// snapshot is saved or loaded, it becomes the base of the next one, which
+// only stores the pages written since then, and loads its base first.
+// Pages are compressed with zlib at its fastest level. A page which does
+// not compress well is stored raw, and it is mapped into pmem on restore
+// instead of being read, so that the host only loads it when it is touched.
+//
+// Saving copies the state to buffers and returns, and the file is compressed
+// and written by a writer thread while the guest goes on.
+
+#define SNAP_MAGIC   "NEMUSNAP"
+#define SNAP_VERSION 1
+#define NR_PAGE      (CONFIG_MSIZE / PAGE_SIZE)
+#define NR_STATE     64
+#define MAX_DEPTH    16 // of a chain of snapshots
+#define ZLIB_MAX_LEN (PAGE_SIZE * 3 / 4) // otherwise the page is stored raw
+
+typedef struct {
+  char magic[8];
+  uint32_t version;
+  uint32_t nr_state;
+  char isa[16];
+  uint64_t mbase, msize;
+  uint64_t nr_guest_inst;
+  uint64_t state_len;  // compressed length of the states
+  uint64_t page_table; // offset of the page table in the file
+  uint64_t nr_page;    // number of entries in the page table
+  char base[PATH_MAX]; // path of the base snapshot, empty if there is none
+} SnapHeader;
+
+typedef struct {
+  char name[32];
+  uint64_t len;
+} StateRecord;
+
+typedef struct {
+  uint64_t offset; // in the file
+  uint32_t idx;    // of the page in pmem
+  uint32_t len;    // 0 for a zero page, PAGE_SIZE for a raw page
+} PageEntry;
+
+static struct {
+  const char *name;
+  void *state;
+  size_t len;
+} states[NR_STATE] = {};
+static int nr_state = 0;
+
+uint64_t snapshot_dirty_map[(NR_PAGE + 63) / 64] = {};
+
+// the snapshots which the next one is based on, from the first one
+static char chain[MAX_DEPTH][PATH_MAX];
+static int nr_chain = 0;
+
+static uint64_t save_at = UINT64_MAX;
+static char *save_at_file = NULL;
+
+void add_snapshot_state(const char *name, void *state, size_t len) {
+  assert(nr_state < NR_STATE);
+  assert(strlen(name) < sizeof(((StateRecord *)0)->name));
+  states[nr_state ++] = (typeof(states[0])) { .name = name, .state = state, .len = len };
+}
+
+static uint8_t* pmem_page(uint32_t idx) {
+  return guest_to_host(CONFIG_MBASE) + (size_t)idx * PAGE_SIZE;
+}
+
+static bool is_zero_page(const uint8_t *p) {
+  const uint64_t *w = (const uint64_t *)p;
+  for (int i = 0; i < PAGE_SIZE / 8; i ++) {
+    if (w[i] != 0) return false;
+  }
+  return true;
+}
+
+// pages can be mapped into pmem only if they are host pages
+static bool can_map() {
+  return ((uintptr_t)guest_to_host(CONFIG_MBASE) & PAGE_MASK) == 0 && sysconf(_SC_PAGESIZE) == PAGE_SIZE;
+}
+
+// ----------- save -----------
+
+typedef struct {
+  char file[PATH_MAX];
+  SnapHeader hdr;
+  uint8_t *state; // serialized state records
+  size_t state_len;
+  uint32_t *idx;  // pages to store
+  uint8_t *page;  // and their contents
+} SaveJob;
+
+static pthread_t writer;
+static bool writer_busy = false;
+
+void snapshot_wait() {
+  if (writer_busy) {
+    pthread_join(writer, NULL);
+    writer_busy = false;
+  }
+}
+
+// a forked process, e.g. a checkpoint for reverse execution,
+// does not have the writer thread
+static void snapshot_atfork_child() {
+  writer_busy = false;
+}
+
+// return the length of the compressed page, or PAGE_SIZE to store it raw
+static uint32_t compress_page(z_stream *zs, uint8_t *in, uint8_t *out) {
+#ifdef CONFIG_SNAPSHOT_COMPRESS
+  deflateReset(zs);
+  zs->next_in = in;
+  zs->avail_in = PAGE_SIZE;
+  zs->next_out = out;
+  zs->avail_out = ZLIB_MAX_LEN;
+  return (deflate(zs, Z_FINISH) == Z_STREAM_END ? ZLIB_MAX_LEN - zs->avail_out : PAGE_SIZE);
+#else
+  return PAGE_SIZE;
+#endif
+}
+
+static void* write_snapshot(void *arg) {
+  SaveJob *job = arg;
+  uint64_t n = job->hdr.nr_page;
+  PageEntry *table = malloc(sizeof(PageEntry) * n);
+  assert(table);
+  char tmp[PATH_MAX + 8];
+  snprintf(tmp, sizeof(tmp), "%s.tmp", job->file);
+  FILE *fp = fopen(tmp, "wb");
+  if (fp == NULL) {
+    Log("Can not open '%s' to save the snapshot", tmp);
+    goto out;
+  }
+
+  uLongf zlen = compressBound(job->state_len);
+  uint8_t *zstate = malloc(zlen);
+  assert(zstate);
+  int ret = compress2(zstate, &zlen, job->state, job->state_len, Z_BEST_SPEED);
+  assert(ret == Z_OK);
+  job->hdr.state_len = zlen;
+
+  // the header is written again at the end with the page table
+  fwrite(&job->hdr, sizeof(job->hdr), 1, fp);
+  fwrite(zstate, zlen, 1, fp);
+  free(zstate);
+  uint64_t off = sizeof(job->hdr) + zlen;
+
+  z_stream zs = {};
+  ret = deflateInit(&zs, Z_BEST_SPEED);
+  assert(ret == Z_OK);
+  static uint8_t buf[ZLIB_MAX_LEN];
+  for (uint64_t i = 0; i < n; i ++) {
+    uint8_t *p = job->page + i * PAGE_SIZE;
+    table[i] = (PageEntry) { .offset = off, .idx = job->idx[i], .len = 0 };
+    if (is_zero_page(p)) continue;
+    table[i].len = compress_page(&zs, p, buf);
+    if (table[i].len < PAGE_SIZE) {
+      fwrite(buf, table[i].len, 1, fp);
+      off += table[i].len;
+    }
+  }
+  deflateEnd(&zs);
+
+  off = (off + PAGE_MASK) & ~PAGE_MASK;
+  fseek(fp, off, SEEK_SET);
+  for (uint64_t i = 0; i < n; i ++) {
+    if (table[i].len == PAGE_SIZE) {
+      table[i].offset = off;
+      fwrite(job->page + i * PAGE_SIZE, PAGE_SIZE, 1, fp);
+      off += PAGE_SIZE;
+    }
+  }
+
+  job->hdr.page_table = off;
+  fwrite(table, sizeof(PageEntry), n, fp);
+  fseek(fp, 0, SEEK_SET);
+  fwrite(&job->hdr, sizeof(job->hdr), 1, fp);
+  bool ok = !ferror(fp);
+  ok &= (fclose(fp) == 0);
+  if (ok && rename(tmp, job->file) == 0) {
+    Log("Snapshot at %" PRIu64 " instructions is saved to %s, %" PRIu64 " pages in %" PRIu64 " bytes",
+        job->hdr.nr_guest_inst, job->file, n, off + sizeof(PageEntry) * n);
+  } else {
+    Log("Fail to write the snapshot to %s", job->file);
+    unlink(tmp);
+  }
+
+out:
+  free(table);
+  free(job->state);
+  free(job->idx);
+  free(job->page);
+  free(job);
+  return NULL;
+}
+
+bool snapshot_save(const char *file) {
+  snapshot_wait();
+  SaveJob *job = calloc(1, sizeof(*job));
+  assert(job);
+  // bases are loaded from any working directory
+  char cwd[PATH_MAX];
+  Assert(file[0] == '/' || getcwd(cwd, sizeof(cwd)) != NULL, "Can not get the working directory");
+  int len = snprintf(job->file, sizeof(job->file), "%s%s%s",
+      (file[0] == '/' ? "" : cwd), (file[0] == '/' ? "" : "/"), file);
+  if (len >= sizeof(job->file)) {
+    printf("The path of the snapshot is too long.\n");
+    free(job);
+    return false;
+  }
+
+  // a file in the chain can not be overwritten by a snapshot based on it
+  for (int i = 0; i < nr_chain; i ++) {
+    if (strcmp(chain[i], job->file) == 0) nr_chain = 0;
+  }
+  if (nr_chain == MAX_DEPTH) nr_chain = 0;
+
+  SnapHeader *hdr = &job->hdr;
+  memcpy(hdr->magic, SNAP_MAGIC, sizeof(hdr->magic));
+  hdr->version = SNAP_VERSION;
+  hdr->nr_state = nr_state;
+  strncpy(hdr->isa, str(__GUEST_ISA__), sizeof(hdr->isa) - 1);
+  hdr->mbase = CONFIG_MBASE;
+  hdr->msize = CONFIG_MSIZE;
+  hdr->nr_guest_inst = g_nr_guest_inst;
+  if (nr_chain > 0) strcpy(hdr->base, chain[nr_chain - 1]);
+
+  for (int i = 0; i < nr_state; i ++) job->state_len += sizeof(StateRecord) + states[i].len;
+  job->state = malloc(job->state_len);
+  assert(job->state);
+  uint8_t *s = job->state;
+  for (int i = 0; i < nr_state; i ++) {
+    StateRecord r = { .len = states[i].len };
+    strcpy(r.name, states[i].name);
+    memcpy(s, &r, sizeof(r));
+    memcpy(s + sizeof(r), states[i].state, states[i].len);
+    s += sizeof(r) + states[i].len;
+  }
+
+  // a zero page is not stored, unless it overwrites a page of the base
+  job->idx = malloc(sizeof(uint32_t) * NR_PAGE);
+  assert(job->idx);
+  uint64_t n = 0;
+  for (uint32_t i = 0; i < NR_PAGE; i ++) {
+    bool dirty = (snapshot_dirty_map[i / 64] >> (i % 64)) & 1;
+    if (nr_chain > 0 ? dirty : !is_zero_page(pmem_page(i))) job->idx[n ++] = i;
+  }
+  memset(snapshot_dirty_map, 0, sizeof(snapshot_dirty_map));
+  job->page = malloc(n * PAGE_SIZE + 1);
+  assert(job->page);
+  for (uint64_t i = 0; i < n; i ++) memcpy(job->page + i * PAGE_SIZE, pmem_page(job->idx[i]), PAGE_SIZE);
+  hdr->nr_page = n;
+
+  strcpy(chain[nr_chain ++], job->file);
+  int ret = pthread_create(&writer, NULL, write_snapshot, job);
+  Assert(ret == 0, "Can not create the snapshot writer thread");
+  writer_busy = true;
+  return true;
+}
+
+// ----------- load -----------
+
+static void clear_pmem() {
+  uint8_t *p = guest_to_host(CONFIG_MBASE);
+  // dropping the pages is faster than writing zeros to them
+  if (can_map() && mmap(p, CONFIG_MSIZE, PROT_READ | PROT_WRITE,
+        MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED, -1, 0) != MAP_FAILED) return;
+  memset(p, 0, CONFIG_MSIZE);
+}
+
+static bool load_page(int fd, PageEntry *e, z_stream *zs, bool map) {
+  uint8_t *p = pmem_page(e->idx);
+  if (e->len == 0) {
+    memset(p, 0, PAGE_SIZE);
+    return true;
+  }
+  if (e->len == PAGE_SIZE) {
+    if (map && mmap(p, PAGE_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED, fd, e->offset) != MAP_FAILED) {
+      return true;
+    }
+    return pread(fd, p, PAGE_SIZE, e->offset) == PAGE_SIZE;
+  }
+  static uint8_t buf[ZLIB_MAX_LEN];
+  if (e->len > ZLIB_MAX_LEN || pread(fd, buf, e->len, e->offset) != e->len) return false;
+  inflateReset(zs);
+  zs->next_in = buf;
+  zs->avail_in = e->len;
+  zs->next_out = p;
+  zs->avail_out = PAGE_SIZE;
+  return inflate(zs, Z_FINISH) == Z_STREAM_END && zs->avail_out == 0;
+}
+
+// Load the pages of the snapshot in `file` after those of its bases. For
+// the snapshot being restored (depth 0), also read its states to `state`.
+static bool load_file(const char *file, int depth, uint8_t **state, SnapHeader *hdr) {
+  if (depth == MAX_DEPTH) {
+    Log("The chain of snapshots is too long at %s", file);
+    return false;
+  }
+  int fd = open(file, O_RDONLY);
+  if (fd < 0) {
+    Log("Can not open the snapshot %s", file);
+    return false;
+  }
+
+  bool ok = false;
+  PageEntry *table = NULL;
+  if (pread(fd, hdr, sizeof(*hdr), 0) != sizeof(*hdr) ||
+      memcmp(hdr->magic, SNAP_MAGIC, sizeof(hdr->magic)) != 0 || hdr->version != SNAP_VERSION) {
+    Log("%s is not a snapshot", file);
+    goto out;
+  }
+  if (strcmp(hdr->isa, str(__GUEST_ISA__)) != 0 || hdr->mbase != CONFIG_MBASE ||
+      hdr->msize != CONFIG_MSIZE || hdr->nr_state != nr_state || hdr->nr_page > NR_PAGE) {
+    Log("The snapshot %s is saved by NEMU of another configuration", file);
+    goto out;
+  }
+
+  // check the states before anything is changed, only those of the
+  // snapshot being restored are used
+  if (depth == 0) {
+    uLongf len = 0;
+    for (int i = 0; i < nr_state; i ++) len += sizeof(StateRecord) + states[i].len;
+    uLongf expect = len;
+    *state = malloc(len);
+    uint8_t *zstate = malloc(hdr->state_len + 1);
+    assert(*state && zstate);
+    bool state_ok = pread(fd, zstate, hdr->state_len, sizeof(*hdr)) == hdr->state_len &&
+      uncompress(*state, &len, zstate, hdr->state_len) == Z_OK && len == expect;
+    free(zstate);
+    uint8_t *s = *state;
+    for (int i = 0; i < nr_state && state_ok; i ++) {
+      StateRecord r;
+      memcpy(&r, s, sizeof(r));
+      state_ok = (strncmp(r.name, states[i].name, sizeof(r.name)) == 0 && r.len == states[i].len);
+      s += sizeof(r) + states[i].len;
+    }
+    if (!state_ok) {
+      Log("The states in the snapshot %s do not match this NEMU", file);
+      goto out;
+    }
+  }
+
+  table = malloc(sizeof(PageEntry) * hdr->nr_page + 1);
+  assert(table);
+  size_t table_len = sizeof(PageEntry) * hdr->nr_page;
+  if (pread(fd, table, table_len, hdr->page_table) != table_len) {
+    Log("The snapshot %s is truncated", file);
+    goto out;
+  }
+
+  if (hdr->base[0] != '\0') {
+    SnapHeader base_hdr;
+    if (!load_file(hdr->base, depth + 1, NULL, &base_hdr)) goto out;
+  } else {
+    clear_pmem();
+  }
+
+  z_stream zs = {};
+  int ret = inflateInit(&zs);
+  assert(ret == Z_OK);
+  bool map = can_map();
+  ok = true;
+  for (uint64_t i = 0; i < hdr->nr_page && ok; i ++) {
+    ok = (table[i].idx < NR_PAGE && load_page(fd, &table[i], &zs, map));
+  }
+  inflateEnd(&zs);
+  if (!ok) Log("The snapshot %s is corrupted", file);
+  else strcpy(chain[nr_chain ++], file);
+
+out:
+  free(table);
+  close(fd);
+  return ok;
+}
+
+bool snapshot_load(const char *file) {
+  snapshot_wait();
+  nr_chain = 0;
+  uint8_t *state = NULL;
+  SnapHeader *hdr = malloc(sizeof(SnapHeader));
+  assert(hdr);
+  char path[PATH_MAX];
+  bool ok = (realpath(file, path) != NULL && load_file(path, 0, &state, hdr));
+  if (ok) {
+    uint8_t *s = state;
+    for (int i = 0; i < nr_state; i ++) {
+      s += sizeof(StateRecord);
+      memcpy(states[i].state, s, states[i].len);
+      s += states[i].len;
+    }
+    g_nr_guest_inst = hdr->nr_guest_inst;
+    memset(snapshot_dirty_map, 0, sizeof(snapshot_dirty_map));
+    // the machine can go on even if it has stopped when the snapshot is loaded
+    if (nemu_state.state != NEMU_QUIT) nemu_state.state = NEMU_STOP;
+    IFDEF(CONFIG_DIFFTEST, difftest_attach());
+    Log("Snapshot at %" PRIu64 " instructions is restored from %s", g_nr_guest_inst, path);
+  } else {
+    nr_chain = 0;
+    Log("Fail to restore the snapshot %s", file);
+  }
+  free(state);
+  free(hdr);
+  return ok;
+}
+
+// ----------- scheduled save -----------
+
+uint64_t snapshot_save_at() {
+  return save_at;
+}
+
+void snapshot_save_scheduled() {
+  if (g_nr_guest_inst < save_at) return;
+  // it is missed if the machine is restored to a later point
+  bool due = (g_nr_guest_inst == save_at);
+  save_at = UINT64_MAX;
+  if (due) snapshot_save(save_at_file);
+}
+
+// `restore_file` is restored at once, and `save_spec` is N:FILE which
+// schedules a snapshot to FILE after N instructions
+void init_snapshot(const char *restore_file, char *save_spec) {
+  add_snapshot_state("cpu", &cpu, sizeof(cpu));
+  atexit(snapshot_wait);
+  pthread_atfork(NULL, NULL, snapshot_atfork_child);
+
+  if (save_spec != NULL) {
+    char *file = strchr(save_spec, ':');
+    Assert(file != NULL && file != save_spec, "--save-at expects N:FILE, but gets '%s'", save_spec);
+    *file = '\0';
+    save_at = strtoull(save_spec, NULL, 0);
+    save_at_file = file + 1;
+    Log("A snapshot will be saved to %s after %" PRIu64 " instructions", save_at_file, save_at);
+  }
+  if (restore_file != NULL) {
+    Assert(snapshot_load(restore_file), "Can not restore the snapshot %s", restore_file);
+  }
+}
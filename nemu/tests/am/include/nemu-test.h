@@ -0,0 +1,73 @@
+/***************************************************************************************
+* Copyright (c) 2014-2024 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+#ifndef __NEMU_TEST_H__
+#define __NEMU_TEST_H__
+
+#include <am.h>
+#include <klib-macros.h>
+
+// The tests only rely on AM and the helpers below, and not on klib, so
+// that they can check NEMU before klib is finished.
+
+#define TESTS(_) \
+  _(cpu) \
+  _(mmio) \
+  _(vga) \
+  _(audio) \
+  _(wav) \
+  _(disk) \
+  _(overlay_write) \
+  _(overlay_read) \
+  _(sdcard) \
+  _(serial) \
+  _(net_send) \
+  _(net_recv) \
+  _(gpu) \
+  _(screen) \
+  _(hostcall) \
+  _(hle) \
+  _(idle) \
+  _(pvclock) \
+  _(snapshot_save) \
+  _(snapshot_restore) \
+  _(checkpoint)
+
+#define TEST_DECL(name) void test_##name();
+TESTS(TEST_DECL)
+
+// the devices of NEMU, which are not exported by AM
+#define DEVICE_BASE 0xa0000000
+#define RTC_ADDR    (DEVICE_BASE + 0x0000048)
+#define SERIAL_ADDR (DEVICE_BASE + 0x00003f8)
+#define AUDIO_ADDR  (DEVICE_BASE + 0x0000200)
+#define DISK_ADDR   (DEVICE_BASE + 0x0000300)
+#define NET_ADDR    (DEVICE_BASE + 0x0000400)
+#define FB_ADDR     (DEVICE_BASE + 0x1000000)
+#define SDCARD_ADDR (DEVICE_BASE + 0x3000000)
+
+static inline uint32_t mmio_read(uintptr_t addr) { return *(volatile uint32_t *)addr; }
+static inline void mmio_write(uintptr_t addr, uint32_t data) { *(volatile uint32_t *)addr = data; }
+static inline uint8_t mmio_read8(uintptr_t addr) { return *(volatile uint8_t *)addr; }
+
+void print(const char *s);
+void print_hex(uint32_t x);
+void check_fail(const char *file, int line, const char *cond);
+bool mem_eq(const void *s1, const void *s2, int n);
+
+#define check(cond) \
+  do { if (!(cond)) check_fail(__FILE__, __LINE__, #cond); } while (0)
+
+#endif
@@ -0,0 +1,44 @@
+/***************************************************************************************
+* Copyright (c) 2014-2024 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+#include <nemu-test.h>
+
+#define AUDIO_COUNT_ADDR (AUDIO_ADDR + 0x14)
+
+static uint8_t buf[4096];
+
+// Run with --audio-capture=wav-rt:FILE, which consumes the stream buffer in
+// real time, so that the guest has to wait for free space.
+void test_audio() {
+  AM_AUDIO_CONFIG_T cfg = io_read(AM_AUDIO_CONFIG);
+  check(cfg.present && cfg.bufsize > 0);
+  io_write(AM_AUDIO_CTRL, 48000, 2, 1024);
+  check(io_read(AM_AUDIO_STATUS).count == 0);
+
+  for (int i = 0; i < sizeof(buf); i ++) buf[i] = i;
+  for (int total = 0; total < cfg.bufsize * 2; total += sizeof(buf)) {
+    io_write(AM_AUDIO_PLAY, RANGE(buf, buf + sizeof(buf)));
+    int count = io_read(AM_AUDIO_STATUS).count;
+    check(count <= cfg.bufsize);
+  }
+
+  // a count larger than the free space only fills the stream buffer
+  mmio_write(AUDIO_COUNT_ADDR, 0x7fffffff);
+  check(io_read(AM_AUDIO_STATUS).count <= cfg.bufsize);
+
+  // initializing again empties the stream buffer
+  io_write(AM_AUDIO_CTRL, 48000, 2, 1024);
+  check(io_read(AM_AUDIO_STATUS).count == 0);
+}
@@ -0,0 +1,27 @@
+/***************************************************************************************
+* Copyright (c) 2014-2024 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+
+#include <nemu-test.h>
+
+#define N 100000
+
+// A long loop, which the runner steps into and back with sdb, and checks
+// that the registers after stepping back are the same as before.
+void test_checkpoint() {
+  volatile uint32_t sum = 0;
+  for (uint32_t i = 0; i < N; i ++) sum += i;
+  check(sum == (uint32_t)((uint64_t)N * (N - 1) / 2));
+}
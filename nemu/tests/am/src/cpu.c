@@ -0,0 +1,98 @@
+/***************************************************************************************
+* Copyright (c) 2014-2024 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+
+#include <nemu-test.h>
+
+// A workload for the difftest suites, which compare every instruction
+// with the reference. The guest checks its own results as well, so the
+// test also means something without difftest.
+
+#define NR_DATA 1024
+#define BUF_SIZE (64 * 1024)
+
+static uint32_t data[NR_DATA];
+static uint8_t buf[BUF_SIZE];
+
+static uint32_t seed = 1;
+static uint32_t rand32() {
+  seed = seed * 1103515245 + 12345;
+  return (seed >> 16) | (seed << 16);
+}
+
+static void test_sort() {
+  uint32_t sum = 0;
+  for (int i = 0; i < NR_DATA; i ++) {
+    data[i] = rand32();
+    sum += data[i];
+  }
+  for (int i = 1; i < NR_DATA; i ++) {
+    uint32_t x = data[i];
+    int j;
+    for (j = i - 1; j >= 0 && data[j] > x; j --) data[j + 1] = data[j];
+    data[j + 1] = x;
+  }
+  for (int i = 1; i < NR_DATA; i ++) {
+    check(data[i - 1] <= data[i]);
+    sum -= data[i];
+  }
+  check(sum == data[0]);
+}
+
+static void test_muldiv() {
+  for (int i = 0; i < NR_DATA; i ++) {
+    int32_t a = rand32(), b = rand32() >> (i % 32);
+    if (b == 0 || (a == INT32_MIN && b == -1)) continue;
+    int32_t q = a / b, r = a % b;
+    check((uint32_t)q * b + r == a);
+    check(r == 0 || (r < 0) == (a < 0));
+    uint32_t ua = a, ub = b;
+    check(ua / ub * ub + ua % ub == ua && ua % ub < ub);
+
+    // the high half of the product, with 16-bit partial products
+    uint64_t p = (uint64_t)ua * ub;
+    uint32_t al = ua & 0xffff, ah = ua >> 16, bl = ub & 0xffff, bh = ub >> 16;
+    uint32_t mid = (al * bl >> 16) + (ah * bl & 0xffff) + (al * bh & 0xffff);
+    check((uint32_t)(p >> 32) == ah * bh + (ah * bl >> 16) + (al * bh >> 16) + (mid >> 16));
+    check((uint32_t)p == ua * ub);
+  }
+}
+
+static uint32_t crc32(const uint8_t *s, int n) {
+  uint32_t crc = ~0u;
+  for (int i = 0; i < n; i ++) {
+    crc ^= s[i];
+    for (int k = 0; k < 8; k ++) crc = (crc >> 1) ^ (0xedb88320 & -(crc & 1));
+  }
+  return ~crc;
+}
+
+// stores of all sizes over many pages
+static void test_mem() {
+  check(crc32((const uint8_t *)"123456789", 9) == 0xcbf43926);
+  for (int i = 0; i < BUF_SIZE; i ++) buf[i] = i * 7 ^ (i >> 8);
+  uint32_t crc = crc32(buf, BUF_SIZE);
+  uint16_t *h = (uint16_t *)buf;
+  for (int i = 0; i < BUF_SIZE / 2; i ++) h[i] = ~h[i];
+  uint32_t *w = (uint32_t *)buf;
+  for (int i = 0; i < BUF_SIZE / 4; i ++) w[i] = ~w[i];
+  check(crc32(buf, BUF_SIZE) == crc);
+}
+
+void test_cpu() {
+  test_sort();
+  test_muldiv();
+  test_mem();
+}
@@ -0,0 +1,70 @@
+/***************************************************************************************
+* Copyright (c) 2014-2024 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+#include <nemu-test.h>
+
+#define DISK_STATUS_ADDR (DISK_ADDR + 0x18)
+
+enum { DISK_OK, DISK_ERR_CMD, DISK_ERR_RANGE, DISK_ERR_BUF };
+
+#define BLKSZ  512
+#define NR_BLK 4
+
+static uint8_t orig[NR_BLK * BLKSZ], data[2 * BLKSZ], back[NR_BLK * BLKSZ];
+
+static void blkio(bool write, void *buf, int blkno, int blkcnt) {
+  io_write(AM_DISK_BLKIO, write, buf, blkno, blkcnt);
+}
+
+static int disk_status() { return mmio_read(DISK_STATUS_ADDR); }
+
+// Without an image, every command fails. With an image, blocks 1 and 2 are
+// overwritten in one transfer and read back with their neighbours, then
+// the image is put back as it was.
+void test_disk() {
+  AM_DISK_CONFIG_T cfg = io_read(AM_DISK_CONFIG);
+  if (!cfg.present) {
+    blkio(false, back, 0, 1);
+    check(disk_status() == DISK_ERR_RANGE);
+    blkio(false, back, 0, 0);
+    check(disk_status() == DISK_ERR_RANGE);
+    return;
+  }
+  check(cfg.blksz == BLKSZ && cfg.blkcnt >= NR_BLK);
+
+  blkio(false, orig, 0, NR_BLK);
+  check(disk_status() == DISK_OK);
+  for (int i = 0; i < sizeof(data); i ++) data[i] = ~orig[BLKSZ + i];
+  blkio(true, data, 1, 2);
+  check(disk_status() == DISK_OK);
+  blkio(false, back, 0, NR_BLK);
+  check(disk_status() == DISK_OK);
+  check(mem_eq(back, orig, BLKSZ));
+  check(mem_eq(back + BLKSZ, data, sizeof(data)));
+  check(mem_eq(back + 3 * BLKSZ, orig + 3 * BLKSZ, BLKSZ));
+  blkio(true, orig, 0, NR_BLK);
+  check(disk_status() == DISK_OK);
+
+  // an empty transfer does nothing, even at the end of the image
+  back[0] = ~orig[0];
+  blkio(false, back, cfg.blkcnt, 0);
+  check(disk_status() == DISK_OK && back[0] == (uint8_t)~orig[0]);
+
+  // the transfers which do not fit in the image or pmem fail
+  blkio(false, back, cfg.blkcnt - 1, 2);
+  check(disk_status() == DISK_ERR_RANGE);
+  blkio(false, (void *)DEVICE_BASE, 0, 1);
+  check(disk_status() == DISK_ERR_BUF);
+}
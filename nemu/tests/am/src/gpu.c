@@ -0,0 +1,76 @@
+/***************************************************************************************
+* Copyright (c) 2014-2024 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+#include <nemu-test.h>
+
+// texture memory layout of the test
+#define TEX_OFF   0x1000
+#define ROOT_OFF  0x0
+#define CHILD_OFF 0x100
+#define SIB_OFF   0x200
+#define EDGE_OFF  0x300
+
+#define X0 10
+#define Y0 20
+#define BG 0x12345678
+
+static const uint32_t tex[4] = { 0xff0000, 0x00ff00, 0x0000ff, 0xffffff };
+static struct gpu_canvas cv;
+
+static void put_canvas(uint32_t off, int type, int w, int h, int x1, int y1, int w1, int h1,
+    gpuptr_t sibling) {
+  cv.type = type; cv.w = w; cv.h = h;
+  cv.x1 = x1; cv.y1 = y1; cv.w1 = w1; cv.h1 = h1;
+  cv.sibling = sibling;
+  io_write(AM_GPU_MEMCPY, off, &cv, sizeof(cv));
+}
+
+static void put_texture(uint32_t off, int x1, int y1, int w1, int h1, gpuptr_t sibling) {
+  cv.texture.w = 2; cv.texture.h = 2; cv.texture.pixels = TEX_OFF;
+  put_canvas(off, AM_GPU_TEXTURE, 0, 0, x1, y1, w1, h1, sibling);
+}
+
+// The 2x2 texture is drawn into an 8x8 subtree at (X0, Y0), scaled to 4x4
+// at (0, 0) and unscaled at (4, 4), and then at the bottom right corner of
+// the screen, where only its first pixel is visible.
+void test_gpu() {
+  AM_GPU_CONFIG_T cfg = io_read(AM_GPU_CONFIG);
+  check(cfg.has_accel && cfg.vmemsz > TEX_OFF + sizeof(tex));
+  int W = cfg.width, H = cfg.height;
+  volatile uint32_t *fb = (uint32_t *)FB_ADDR;
+  for (int i = 0; i < W * H; i ++) fb[i] = BG;
+
+  io_write(AM_GPU_MEMCPY, TEX_OFF, (void *)tex, sizeof(tex));
+  put_texture(CHILD_OFF, 0, 0, 4, 4, SIB_OFF);
+  put_texture(SIB_OFF, 4, 4, 2, 2, AM_GPU_NULL);
+  cv.child = CHILD_OFF;
+  put_canvas(ROOT_OFF, AM_GPU_SUBTREE, 8, 8, X0, Y0, 8, 8, AM_GPU_NULL);
+  io_write(AM_GPU_RENDER, ROOT_OFF);
+
+  for (int y = 0; y < 8; y ++) {
+    for (int x = 0; x < 8; x ++) {
+      uint32_t expect = 0;
+      if (x < 4 && y < 4) expect = tex[(y / 2) * 2 + x / 2];
+      else if (x >= 4 && x < 6 && y >= 4 && y < 6) expect = tex[(y - 4) * 2 + (x - 4)];
+      check(fb[(Y0 + y) * W + X0 + x] == expect);
+    }
+  }
+  check(fb[Y0 * W + X0 - 1] == BG && fb[Y0 * W + X0 + 8] == BG);
+  check(fb[(Y0 - 1) * W + X0] == BG && fb[(Y0 + 8) * W + X0] == BG);
+
+  put_texture(EDGE_OFF, W - 1, H - 1, 2, 2, AM_GPU_NULL);
+  io_write(AM_GPU_RENDER, EDGE_OFF);
+  check(fb[W * H - 1] == tex[0] && fb[W * H - 2] == BG);
+}
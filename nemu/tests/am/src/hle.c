@@ -0,0 +1,48 @@
+/***************************************************************************************
+* Copyright (c) 2014-2024 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+
+#include <nemu-test.h>
+#include <klib.h>
+
+// Run with --elf, so that the functions of klib below are run on the host,
+// and the test passes even if klib does not implement them yet. The runner
+// checks in the output that they are hooked.
+void test_hle() {
+  static char src[64], dst[64];
+  for (int i = 0; i < sizeof(src); i ++) src[i] = i * 3 + 1;
+
+  check(memcpy(dst, src, sizeof(src)) == dst);
+  check(mem_eq(dst, src, sizeof(src)));
+  // overlapping copies work as memmove()
+  check(memcpy(dst + 1, dst, 16) == dst + 1);
+  check(dst[0] == src[0] && mem_eq(dst + 1, src, 16));
+
+  // nothing is copied or set for zero bytes
+  check(memcpy(dst, src + 1, 0) == dst && dst[0] == src[0]);
+  check(memset(dst, 0, 0) == dst && dst[0] == src[0]);
+
+  check(memset(dst, 0x5a, 10) == dst);
+  for (int i = 0; i < 10; i ++) check(dst[i] == 0x5a);
+  check(dst[10] == src[9]);
+
+  check(strlen("") == 0);
+  check(strlen("hello nemu") == 10);
+
+  check(memcmp(src, src, sizeof(src)) == 0);
+  check(memcmp("abc", "abd", 3) < 0);
+  check(memcmp("abd", "abc", 3) > 0);
+  check(memcmp("abc", "abd", 2) == 0);
+}
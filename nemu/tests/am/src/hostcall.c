@@ -0,0 +1,88 @@
+/***************************************************************************************
+* Copyright (c) 2014-2024 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+
+#include <nemu-test.h>
+#include <hostcall-def.h>
+
+#ifdef __riscv
+#define SEEK_SET 0
+
+static uint32_t hostcall(uint32_t service, uint32_t arg1, uint32_t arg2, uint32_t arg3, uint32_t *hi) {
+  register uint32_t a0 asm("a0") = service;
+  register uint32_t a1 asm("a1") = arg1;
+  register uint32_t a2 asm("a2") = arg2;
+  register uint32_t a3 asm("a3") = arg3;
+  register uint32_t a7 asm("a7") = HOSTCALL_MAGIC;
+  asm volatile ("ebreak" : "+r"(a0), "+r"(a1) : "r"(a2), "r"(a3), "r"(a7) : "memory");
+  if (hi) *hi = a1;
+  return a0;
+}
+
+#define HC(service, a1, a2, a3) \
+  (int32_t)hostcall(HOSTCALL_##service, (uintptr_t)(a1), (uintptr_t)(a2), (uintptr_t)(a3), NULL)
+
+static const char msg[] = "written by the guest\n";
+
+// Run with --hostcall-root set to a directory holding in.txt with
+// "hello nemu", and outside.txt next to it. The runner checks out.txt and
+// the line printed to stdout.
+void test_hostcall() {
+  char buf[32];
+  int fd = HC(OPEN, "in.txt", HOSTCALL_O_RDONLY, 0);
+  check(fd > 2);
+  check(HC(READ, fd, buf, sizeof(buf)) == 10);
+  check(mem_eq(buf, "hello nemu", 10));
+  check(HC(LSEEK, fd, 6, SEEK_SET) == 6);
+  check(HC(READ, fd, buf, sizeof(buf)) == 4);
+  check(mem_eq(buf, "nemu", 4));
+  check(HC(READ, fd, buf, sizeof(buf)) == 0);
+  check(HC(CLOSE, fd, 0, 0) == 0);
+  check(HC(READ, fd, buf, sizeof(buf)) < 0);
+
+  fd = HC(OPEN, "out.txt", HOSTCALL_O_WRONLY | HOSTCALL_O_CREAT | HOSTCALL_O_TRUNC, 0644);
+  check(fd > 2);
+  check(HC(WRITE, fd, msg, sizeof(msg) - 1) == sizeof(msg) - 1);
+  check(HC(CLOSE, fd, 0, 0) == 0);
+
+  // paths do not get out of the root
+  check(HC(OPEN, "../outside.txt", HOSTCALL_O_RDONLY, 0) < 0);
+  check(HC(OPEN, "/etc/passwd", HOSTCALL_O_RDONLY, 0) < 0);
+  check(HC(OPEN, "sub/../../outside.txt", HOSTCALL_O_RDONLY, 0) < 0);
+  // neither do buffers get out of pmem
+  check(HC(READ, 0, DEVICE_BASE, 1) < 0);
+  check(HC(WRITE, 1, DEVICE_BASE, 1) < 0);
+  check((int32_t)hostcall(0, 0, 0, 0, NULL) < 0);
+
+  char src[8] = "memcpy!", dst[8] = { 0 };
+  check(HC(MEMCPY, dst, src, sizeof(src)) == 0);
+  check(mem_eq(dst, src, sizeof(src)));
+  check(HC(MEMCPY, dst, src + 1, 0) == 0 && dst[0] == src[0]);
+
+  // the time comes from the same clock as the RTC
+  uint64_t before = io_read(AM_TIMER_UPTIME).us;
+  uint32_t hi, lo = hostcall(HOSTCALL_TIME, 0, 0, 0, &hi);
+  uint64_t t = ((uint64_t)hi << 32) | lo;
+  check(t >= before && t - before < 1000000);
+
+  static const char hello[] = "hello from the guest\n";
+  check(HC(WRITE, 1, hello, sizeof(hello) - 1) == sizeof(hello) - 1);
+}
+#else
+// hostcalls are only supported on RISC-V, see CONFIG_HOSTCALL
+void test_hostcall() {
+  check(0);
+}
+#endif
@@ -0,0 +1,34 @@
+/***************************************************************************************
+* Copyright (c) 2014-2024 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+
+#include <nemu-test.h>
+
+#define WAIT_US 5000000
+
+// Run with --idle=warp. The loop below polls the timer, and NEMU warps the
+// guest clock to its end instead of emulating it. The runner checks in the
+// output that the time was warped rather than slept.
+void test_idle() {
+  uint64_t start = io_read(AM_TIMER_UPTIME).us;
+  while (io_read(AM_TIMER_UPTIME).us - start < WAIT_US);
+
+#ifdef __riscv
+  // wfi returns at the next device update, and the time goes on
+  uint64_t t = io_read(AM_TIMER_UPTIME).us;
+  for (int i = 0; i < 10; i ++) asm volatile ("wfi");
+  check(io_read(AM_TIMER_UPTIME).us > t);
+#endif
+}
@@ -0,0 +1,83 @@
+/***************************************************************************************
+* Copyright (c) 2014-2024 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+#include <nemu-test.h>
+
+#define TEST_ENTRY(name) { #name, test_##name },
+static const struct {
+  const char *name;
+  void (*fn)();
+} tests[] = { TESTS(TEST_ENTRY) };
+
+void print(const char *s) {
+  for (; *s; s ++) putch(*s);
+}
+
+void print_hex(uint32_t x) {
+  print("0x");
+  for (int i = 28; i >= 0; i -= 4) putch("0123456789abcdef"[(x >> i) & 0xf]);
+}
+
+static void print_dec(int x) {
+  char buf[12];
+  int i = sizeof(buf) - 1;
+  buf[i] = '\0';
+  do { buf[-- i] = '0' + x % 10; x /= 10; } while (x > 0);
+  print(buf + i);
+}
+
+void check_fail(const char *file, int line, const char *cond) {
+  print("Check failed: ");
+  print(cond);
+  print(" @ ");
+  print(file);
+  putch(':');
+  print_dec(line);
+  putch('\n');
+  halt(1);
+}
+
+bool mem_eq(const void *s1, const void *s2, int n) {
+  const uint8_t *p1 = s1, *p2 = s2;
+  for (int i = 0; i < n; i ++) {
+    if (p1[i] != p2[i]) return false;
+  }
+  return true;
+}
+
+static bool streq(const char *s1, const char *s2) {
+  for (; *s1 && *s1 == *s2; s1 ++, s2 ++);
+  return *s1 == *s2;
+}
+
+int main(const char *args) {
+  ioe_init();
+  for (int i = 0; i < LENGTH(tests); i ++) {
+    if (streq(args, tests[i].name)) {
+      tests[i].fn();
+      print("Test ");
+      print(args);
+      print(" passed\n");
+      return 0;
+    }
+  }
+  print("Usage: make -C $NEMU_HOME/tests run, or mainargs=TEST, where TEST is one of\n");
+  for (int i = 0; i < LENGTH(tests); i ++) {
+    print("  ");
+    print(tests[i].name);
+    putch('\n');
+  }
+  return 1;
+}
@@ -0,0 +1,39 @@
+/***************************************************************************************
+* Copyright (c) 2014-2024 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+
+#include <nemu-test.h>
+
+#define SERIAL_LSR_ADDR (SERIAL_ADDR + 5)
+#define LSR_THRE 0x20
+
+// Loads of all sizes from the devices, mixed with stores to them. Under
+// difftest, the loaded values are forwarded to the reference, which has no
+// devices, so the instructions using them are still checked. The runner
+// checks that the reference took every value in order.
+void test_mmio() {
+  uint64_t last = 0;
+  for (int i = 0; i < 1000; i ++) {
+    uint32_t hi = mmio_read(RTC_ADDR + 4);
+    uint32_t lo = mmio_read(RTC_ADDR);
+    uint64_t t = ((uint64_t)hi << 32) | lo;
+    check(t >= last);
+    last = t;
+    check(*(volatile uint16_t *)RTC_ADDR == (uint16_t)lo);
+    check(mmio_read8(SERIAL_LSR_ADDR) & LSR_THRE);
+    if (i % 100 == 0) putch('.');
+  }
+  putch('\n');
+}
@@ -0,0 +1,122 @@
+/***************************************************************************************
+* Copyright (c) 2014-2024 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+#include <nemu-test.h>
+
+// The tests drive the card without the driver of AM, so that they can
+// hand it descriptors which the driver never makes.
+
+#define NET_PRESENT_ADDR   (NET_ADDR + 0x00)
+#define NET_TX_RING_ADDR   (NET_ADDR + 0x04)
+#define NET_RX_RING_ADDR   (NET_ADDR + 0x08)
+#define NET_RING_SIZE_ADDR (NET_ADDR + 0x0c)
+#define NET_TX_HEAD_ADDR   (NET_ADDR + 0x10)
+#define NET_TX_TAIL_ADDR   (NET_ADDR + 0x14)
+#define NET_RX_HEAD_ADDR   (NET_ADDR + 0x18)
+#define NET_RX_TAIL_ADDR   (NET_ADDR + 0x1c)
+
+#define NET_DESC_DONE  0x1
+#define NET_DESC_TRUNC 0x2
+#define NET_DESC_ERROR 0x4
+
+#define NR_DESC 8
+#define BUF_SIZE 2048
+#define TIMEOUT_US 10000000
+
+typedef struct {
+  uint32_t addr, len, flags, reserved;
+} NetDesc;
+
+static NetDesc tx_ring[NR_DESC], rx_ring[NR_DESC];
+static uint8_t buf[4][BUF_SIZE];
+static const int pkt_len[] = { 60, 1514, 1 };
+
+static void net_setup() {
+  check(mmio_read(NET_PRESENT_ADDR));
+  mmio_write(NET_TX_RING_ADDR, (uintptr_t)tx_ring);
+  mmio_write(NET_RX_RING_ADDR, (uintptr_t)rx_ring);
+  mmio_write(NET_RING_SIZE_ADDR, NR_DESC);
+}
+
+static void set_desc(NetDesc *d, uintptr_t addr, uint32_t len) {
+  d->addr = addr;
+  d->len = len;
+  d->flags = 0;
+}
+
+static void fill_pkt(uint8_t *p, int len) {
+  for (int i = 0; i < len; i ++) p[i] = i * 7 + len;
+}
+
+static bool check_pkt(const uint8_t *p, int len, int pkt_len) {
+  for (int i = 0; i < len; i ++) {
+    if (p[i] != (uint8_t)(i * 7 + pkt_len)) return false;
+  }
+  return true;
+}
+
+// Run with --net=pcap:FILE, the runner checks the size of FILE.
+void test_net_send() {
+  net_setup();
+  uint32_t tail = mmio_read(NET_TX_HEAD_ADDR);
+  for (int i = 0; i < LENGTH(pkt_len); i ++, tail ++) {
+    fill_pkt(buf[i], pkt_len[i]);
+    set_desc(&tx_ring[tail % NR_DESC], (uintptr_t)buf[i], pkt_len[i]);
+  }
+  mmio_write(NET_TX_TAIL_ADDR, tail);
+  check(mmio_read(NET_TX_HEAD_ADDR) == tail);
+  for (int i = 0; i < LENGTH(pkt_len); i ++) check(tx_ring[i].flags == NET_DESC_DONE);
+
+  // a buffer outside pmem is not sent
+  NetDesc *d = &tx_ring[tail % NR_DESC];
+  set_desc(d, DEVICE_BASE, 64);
+  mmio_write(NET_TX_TAIL_ADDR, ++ tail);
+  check(mmio_read(NET_TX_HEAD_ADDR) == tail && d->flags == (NET_DESC_DONE | NET_DESC_ERROR));
+
+  // a tail more than a ring ahead of the head is moved back to the head
+  mmio_write(NET_TX_TAIL_ADDR, tail + 1000);
+  check(mmio_read(NET_TX_TAIL_ADDR) == tail && mmio_read(NET_TX_HEAD_ADDR) == tail);
+}
+
+// Run with --net=pcap:OUT:IN, where IN is the FILE of test_net_send().
+void test_net_recv() {
+  net_setup();
+  set_desc(&rx_ring[0], (uintptr_t)buf[0], BUF_SIZE);
+  set_desc(&rx_ring[1], (uintptr_t)buf[1], 1000);
+  set_desc(&rx_ring[2], DEVICE_BASE, BUF_SIZE);
+  set_desc(&rx_ring[3], (uintptr_t)buf[2], BUF_SIZE);
+  set_desc(&rx_ring[4], (uintptr_t)buf[3], BUF_SIZE);
+  mmio_write(NET_RX_TAIL_ADDR, 5);
+
+  uint64_t start = io_read(AM_TIMER_UPTIME).us;
+  while (mmio_read(NET_RX_HEAD_ADDR) < 4) {
+    check(io_read(AM_TIMER_UPTIME).us - start < TIMEOUT_US);
+  }
+  check(rx_ring[0].flags == NET_DESC_DONE && rx_ring[0].len == pkt_len[0]);
+  check(check_pkt(buf[0], pkt_len[0], pkt_len[0]));
+  // a packet larger than the buffer is truncated
+  check(rx_ring[1].flags == (NET_DESC_DONE | NET_DESC_TRUNC) && rx_ring[1].len == 1000);
+  check(check_pkt(buf[1], 1000, pkt_len[1]));
+  // a buffer outside pmem is skipped without taking a packet
+  check(rx_ring[2].flags == (NET_DESC_DONE | NET_DESC_ERROR) && rx_ring[2].len == 0);
+  check(rx_ring[3].flags == NET_DESC_DONE && rx_ring[3].len == pkt_len[2]);
+  check(check_pkt(buf[2], pkt_len[2], pkt_len[2]));
+
+  // all packets are received
+  check(mmio_read(NET_RX_HEAD_ADDR) == 4 && rx_ring[4].flags == 0);
+
+  mmio_write(NET_RX_TAIL_ADDR, 4 + 1000);
+  check(mmio_read(NET_RX_HEAD_ADDR) == 4 && mmio_read(NET_RX_TAIL_ADDR) == 4);
+}
@@ -0,0 +1,48 @@
+/***************************************************************************************
+* Copyright (c) 2014-2024 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+#include <nemu-test.h>
+
+#define BLKSZ 512
+
+static uint8_t orig[4 * BLKSZ], data[BLKSZ], back[4 * BLKSZ];
+
+static void blkio(bool write, void *buf, int blkno, int blkcnt) {
+  io_write(AM_DISK_BLKIO, write, buf, blkno, blkcnt);
+}
+
+static void fill_data() {
+  for (int i = 0; i < BLKSZ; i ++) data[i] = i * 13 + 5;
+}
+
+// Run with --disk-overlay=FILE and a new FILE. Block 2 is written to the
+// overlay, then blocks 0-3 are read back across the image and the overlay.
+void test_overlay_write() {
+  check(io_read(AM_DISK_CONFIG).blkcnt >= 4);
+  blkio(false, orig, 0, 4);
+  fill_data();
+  blkio(true, data, 2, 1);
+  blkio(false, back, 0, 4);
+  check(mem_eq(back, orig, 2 * BLKSZ));
+  check(mem_eq(back + 2 * BLKSZ, data, BLKSZ));
+  check(mem_eq(back + 3 * BLKSZ, orig + 3 * BLKSZ, BLKSZ));
+}
+
+// Run after test_overlay_write() with the same FILE, which keeps block 2.
+void test_overlay_read() {
+  fill_data();
+  blkio(false, back, 2, 1);
+  check(mem_eq(back, data, BLKSZ));
+}
@@ -0,0 +1,65 @@
+/***************************************************************************************
+* Copyright (c) 2014-2024 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+
+#include <nemu-test.h>
+
+#define PVCLOCK_MAGIC 0x4b435650
+#define TIMEOUT_US 1000000
+
+static uint64_t rtc_us() {
+  // reading the high half latches the time
+  uint32_t hi = mmio_read(RTC_ADDR + 4);
+  uint32_t lo = mmio_read(RTC_ADDR);
+  return ((uint64_t)hi << 32) | lo;
+}
+
+static uint64_t pv_us(volatile uint32_t *pv) {
+  uint32_t seq, lo, hi;
+  do {
+    seq = pv[0];
+    lo = pv[2];
+    hi = pv[3];
+  } while ((seq & 1) || seq != pv[0]);
+  return ((uint64_t)hi << 32) | lo;
+}
+
+// The clock page follows the RTC, a bit behind it, and guest writes to it
+// are dropped.
+void test_pvclock() {
+  volatile uint32_t *pv = (uint32_t *)(uintptr_t)mmio_read(RTC_ADDR + 8);
+  check(pv != NULL);
+  check(pv[1] == PVCLOCK_MAGIC);
+
+  uint64_t t0 = pv_us(pv);
+  uint64_t rtc = rtc_us();
+  check(t0 <= rtc);
+
+  // the page is updated every few instructions
+  uint32_t seq = pv[0];
+  while (pv[0] == seq) check(rtc_us() - rtc < TIMEOUT_US);
+  uint64_t t1 = pv_us(pv);
+  check(t1 >= t0 && t1 <= rtc_us());
+
+  // AM reads the time from the page
+  uint64_t up = io_read(AM_TIMER_UPTIME).us;
+  check(up >= t1 && up <= rtc_us());
+
+  pv[1] = 0;
+  pv[2] = 0;
+  pv[3] = 0;
+  check(pv[1] == PVCLOCK_MAGIC);
+  check(pv_us(pv) >= t1);
+}
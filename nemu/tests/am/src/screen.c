@@ -0,0 +1,30 @@
+/***************************************************************************************
+* Copyright (c) 2014-2024 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+#include <nemu-test.h>
+
+#define NR_FRAME 64
+
+// The frames are synced much faster than the screen refreshes, which must
+// not stop the guest, with or without the device thread.
+void test_screen() {
+  AM_GPU_CONFIG_T cfg = io_read(AM_GPU_CONFIG);
+  check(cfg.present);
+  volatile uint32_t *fb = (uint32_t *)FB_ADDR;
+  for (int f = 0; f < NR_FRAME; f ++) {
+    for (int i = 0; i < cfg.width; i ++) fb[(f % cfg.height) * cfg.width + i] = 0xffffff;
+    io_write(AM_GPU_FBDRAW, 0, 0, NULL, 0, 0, true);
+  }
+}
@@ -0,0 +1,75 @@
+/***************************************************************************************
+* Copyright (c) 2014-2024 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+#include <nemu-test.h>
+
+#define SDCMD     (SDCARD_ADDR + 0x00)
+#define SDARG     (SDCARD_ADDR + 0x04)
+#define SDDMAADDR (SDCARD_ADDR + 0x24)
+#define SDDMALEN  (SDCARD_ADDR + 0x28)
+#define SDDATA    (SDCARD_ADDR + 0x40)
+
+#define MMC_READ_MULTIPLE_BLOCK  18
+#define MMC_WRITE_MULTIPLE_BLOCK 25
+
+#define BLKSZ 512
+#define PIO_BLK 4
+#define DMA_BLK 8
+
+static uint32_t orig[8 * BLKSZ / 4], data[2 * BLKSZ / 4], back[2 * BLKSZ / 4];
+
+static void sd_cmd(int cmd, uint32_t blk) {
+  mmio_write(SDARG, blk);
+  mmio_write(SDCMD, cmd);
+}
+
+static void sd_dma(int cmd, uint32_t blk, void *buf, int len) {
+  sd_cmd(cmd, blk);
+  mmio_write(SDDMAADDR, (uintptr_t)buf);
+  mmio_write(SDDMALEN, len);
+}
+
+static void fill_data(uint32_t seed) {
+  for (int i = 0; i < LENGTH(data); i ++) data[i] = seed * i + 1;
+}
+
+// Blocks 4-11 are written and read back with PIO and DMA, and with both
+// in one sequence, then put back as they were.
+void test_sdcard() {
+  sd_dma(MMC_READ_MULTIPLE_BLOCK, PIO_BLK, orig, sizeof(orig));
+
+  // PIO writes are collected by NEMU, a later read must see them
+  fill_data(0x9e3779b9);
+  sd_cmd(MMC_WRITE_MULTIPLE_BLOCK, PIO_BLK);
+  for (int i = 0; i < LENGTH(data); i ++) mmio_write(SDDATA, data[i]);
+  sd_cmd(MMC_READ_MULTIPLE_BLOCK, PIO_BLK);
+  for (int i = 0; i < LENGTH(back); i ++) back[i] = mmio_read(SDDATA);
+  check(mem_eq(back, data, sizeof(data)));
+
+  fill_data(0x85ebca6b);
+  sd_dma(MMC_WRITE_MULTIPLE_BLOCK, DMA_BLK, data, sizeof(data));
+  sd_dma(MMC_READ_MULTIPLE_BLOCK, DMA_BLK, back, sizeof(back));
+  check(mem_eq(back, data, sizeof(data)));
+
+  // a DMA read continues from the position of the PIO reads before it
+  sd_cmd(MMC_READ_MULTIPLE_BLOCK, DMA_BLK - 1);
+  for (int i = 0; i < BLKSZ / 4; i ++) back[i] = mmio_read(SDDATA);
+  check(mem_eq(back, orig + 3 * BLKSZ / 4, BLKSZ));
+  mmio_write(SDDMAADDR, (uintptr_t)back);
+  mmio_write(SDDMALEN, BLKSZ);
+  check(mem_eq(back, data, BLKSZ));
+
+  sd_dma(MMC_WRITE_MULTIPLE_BLOCK, PIO_BLK, orig, sizeof(orig));
+}
@@ -0,0 +1,42 @@
+/***************************************************************************************
+* Copyright (c) 2014-2024 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+#include <nemu-test.h>
+
+#define SERIAL_LSR_ADDR (SERIAL_ADDR + 5)
+#define LSR_DR 0x01
+
+#define TIMEOUT_US 10000000
+
+// Run with "nemu\n" written to the input FIFO. The line is read without
+// blocking NEMU, and printed back for the runner to check.
+void test_serial() {
+  char line[16];
+  int n = 0;
+  uint64_t start = io_read(AM_TIMER_UPTIME).us;
+  while (n < sizeof(line) - 1) {
+    if (mmio_read8(SERIAL_LSR_ADDR) & LSR_DR) {
+      char ch = mmio_read8(SERIAL_ADDR);
+      if (ch == '\n') break;
+      line[n ++] = ch;
+    } else {
+      check(io_read(AM_TIMER_UPTIME).us - start < TIMEOUT_US);
+    }
+  }
+  line[n] = '\0';
+  print("got ");
+  print(line);
+  putch('\n');
+}
@@ -0,0 +1,46 @@
+/***************************************************************************************
+* Copyright (c) 2014-2024 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+
+#include <nemu-test.h>
+
+#define BUF_SIZE (16 * 1024)
+#define NR_ROUND 16
+#define NR_PIXEL 256
+
+static uint8_t buf[BUF_SIZE];
+
+// The runner saves a snapshot in the middle of test_snapshot_save(), and
+// restores it in another run, which goes on from there and has to print
+// the same result. The work goes through pmem, the registers and the
+// framebuffer of the VGA.
+void test_snapshot_save() {
+  print("snapshot start\n");
+  uint32_t sum = 0;
+  for (int r = 0; r < NR_ROUND; r ++) {
+    for (int i = 0; i < BUF_SIZE; i ++) buf[i] = (i * 7) ^ sum ^ r;
+    for (int i = 0; i < BUF_SIZE; i ++) sum = sum * 31 + buf[i];
+    for (int p = 0; p < NR_PIXEL; p ++) mmio_write(FB_ADDR + (r * NR_PIXEL + p) * 4, sum + p);
+  }
+  for (int i = 0; i < NR_ROUND * NR_PIXEL; i ++) sum = sum * 31 + mmio_read(FB_ADDR + i * 4);
+  print("snapshot result ");
+  print_hex(sum);
+  putch('\n');
+}
+
+// only reached if the snapshot is not restored
+void test_snapshot_restore() {
+  check(0);
+}
@@ -0,0 +1,32 @@
+/***************************************************************************************
+* Copyright (c) 2014-2024 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+#include <nemu-test.h>
+
+// Run with --vga-capture=hash:FILE, which captures a frame at each sync.
+// The runner checks that the first two frames are the same and the third
+// one, which differs in one pixel, is not.
+void test_vga() {
+  AM_GPU_CONFIG_T cfg = io_read(AM_GPU_CONFIG);
+  check(cfg.present && cfg.width > 0 && cfg.height > 0);
+  volatile uint32_t *fb = (uint32_t *)FB_ADDR;
+  int n = cfg.width * cfg.height;
+  for (int i = 0; i < n; i ++) fb[i] = i * 0x010203;
+
+  io_write(AM_GPU_FBDRAW, 0, 0, NULL, 0, 0, true);
+  io_write(AM_GPU_FBDRAW, 0, 0, NULL, 0, 0, true);
+  fb[n / 2] ^= 1;
+  io_write(AM_GPU_FBDRAW, 0, 0, NULL, 0, 0, true);
+}
@@ -0,0 +1,30 @@
+/***************************************************************************************
+* Copyright (c) 2014-2024 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+#include <nemu-test.h>
+
+static uint8_t buf[10000];
+
+// Run with --audio-capture=wav:FILE. The runner checks that FILE holds
+// exactly the samples played here.
+void test_wav() {
+  AM_AUDIO_CONFIG_T cfg = io_read(AM_AUDIO_CONFIG);
+  check(cfg.present);
+  io_write(AM_AUDIO_CTRL, 8000, 1, 1024);
+  for (int i = 0; i < sizeof(buf); i ++) buf[i] = i * 7;
+  io_write(AM_AUDIO_PLAY, RANGE(buf, buf + sizeof(buf)));
+  // the samples are written to FILE as soon as they are played
+  check(io_read(AM_AUDIO_STATUS).count == 0);
+}
@@ -0,0 +1,509 @@
+/***************************************************************************************
+* Copyright (c) 2014-2024 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+#include <assert.h>
+#include <dlfcn.h>
+#include <getopt.h>
+#include <inttypes.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+#include <difftest-def.h>
+
+#if !defined(CONFIG_ISA_riscv) || defined(CONFIG_RV64)
+#error isa-fuzz only supports riscv32
+#endif
+
+// Random programs are generated into the memory of two simulators exporting
+// the difftest REF API, e.g. NEMU built as a shared object and Spike, which
+// run them in lockstep. A program which makes them diverge is shrunk, and
+// saved as an image which sets up the registers and then runs the program.
+//
+// To keep a program running inside itself, branches and jumps only go
+// forward, and loads and stores only access the data area through the
+// base register, which is never written.
+
+#define CODE_BASE 0x80000000u
+#define PROG_BASE (CODE_BASE + 0x100) // after the prologue of the reproducer
+#define DATA_BASE 0x80100000u
+#define DATA_SIZE 4096
+#define BASE_REG  31 // points to the middle of the data area
+#define MAX_LEN   4096
+#define NOP       0x00000013u // addi x0, x0, 0, only in the prologue
+#define EBREAK    0x00100073u
+
+typedef struct {
+  uint32_t gpr[32];
+  uint32_t pc;
+} RegFile;
+
+_Static_assert(sizeof(RegFile) == DIFFTEST_REG_SIZE, "RegFile does not match the difftest registers");
+
+typedef struct {
+  void (*copy_mem)(uint32_t addr, void *buf, size_t n, bool direction);
+  void (*copy_reg)(void *dut, bool direction);
+  void (*exec)(uint64_t n);
+} Sim;
+
+typedef struct {
+  uint32_t code[MAX_LEN];
+  int len;
+  RegFile regs;
+  uint8_t data[DATA_SIZE];
+} Program;
+
+// ----------- generator -----------
+
+enum { TYPE_R, TYPE_I, TYPE_SHIFT, TYPE_U, TYPE_LOAD, TYPE_STORE, TYPE_BRANCH, TYPE_JAL };
+
+typedef struct {
+  const char *name;
+  int type;
+  uint32_t match;
+  int size; // of the memory access
+} InstPattern;
+
+#define OP(opcode, funct3, funct7) ((opcode) | ((funct3) << 12) | ((uint32_t)(funct7) << 25))
+
+static const InstPattern table[] = {
+  { "lui"   , TYPE_U     , 0x37 },
+  { "auipc" , TYPE_U     , 0x17 },
+  { "jal"   , TYPE_JAL   , 0x6f },
+  { "beq"   , TYPE_BRANCH, OP(0x63, 0, 0) },
+  { "bne"   , TYPE_BRANCH, OP(0x63, 1, 0) },
+  { "blt"   , TYPE_BRANCH, OP(0x63, 4, 0) },
+  { "bge"   , TYPE_BRANCH, OP(0x63, 5, 0) },
+  { "bltu"  , TYPE_BRANCH, OP(0x63, 6, 0) },
+  { "bgeu"  , TYPE_BRANCH, OP(0x63, 7, 0) },
+  { "lb"    , TYPE_LOAD  , OP(0x03, 0, 0), 1 },
+  { "lh"    , TYPE_LOAD  , OP(0x03, 1, 0), 2 },
+  { "lw"    , TYPE_LOAD  , OP(0x03, 2, 0), 4 },
+  { "lbu"   , TYPE_LOAD  , OP(0x03, 4, 0), 1 },
+  { "lhu"   , TYPE_LOAD  , OP(0x03, 5, 0), 2 },
+  { "sb"    , TYPE_STORE , OP(0x23, 0, 0), 1 },
+  { "sh"    , TYPE_STORE , OP(0x23, 1, 0), 2 },
+  { "sw"    , TYPE_STORE , OP(0x23, 2, 0), 4 },
+  { "addi"  , TYPE_I     , OP(0x13, 0, 0) },
+  { "slti"  , TYPE_I     , OP(0x13, 2, 0) },
+  { "sltiu" , TYPE_I     , OP(0x13, 3, 0) },
+  { "xori"  , TYPE_I     , OP(0x13, 4, 0) },
+  { "ori"   , TYPE_I     , OP(0x13, 6, 0) },
+  { "andi"  , TYPE_I     , OP(0x13, 7, 0) },
+  { "slli"  , TYPE_SHIFT , OP(0x13, 1, 0x00) },
+  { "srli"  , TYPE_SHIFT , OP(0x13, 5, 0x00) },
+  { "srai"  , TYPE_SHIFT , OP(0x13, 5, 0x20) },
+  { "add"   , TYPE_R     , OP(0x33, 0, 0x00) },
+  { "sub"   , TYPE_R     , OP(0x33, 0, 0x20) },
+  { "sll"   , TYPE_R     , OP(0x33, 1, 0x00) },
+  { "slt"   , TYPE_R     , OP(0x33, 2, 0x00) },
+  { "sltu"  , TYPE_R     , OP(0x33, 3, 0x00) },
+  { "xor"   , TYPE_R     , OP(0x33, 4, 0x00) },
+  { "srl"   , TYPE_R     , OP(0x33, 5, 0x00) },
+  { "sra"   , TYPE_R     , OP(0x33, 5, 0x20) },
+  { "or"    , TYPE_R     , OP(0x33, 6, 0x00) },
+  { "and"   , TYPE_R     , OP(0x33, 7, 0x00) },
+  { "mul"   , TYPE_R     , OP(0x33, 0, 0x01) },
+  { "mulh"  , TYPE_R     , OP(0x33, 1, 0x01) },
+  { "mulhsu", TYPE_R     , OP(0x33, 2, 0x01) },
+  { "mulhu" , TYPE_R     , OP(0x33, 3, 0x01) },
+  { "div"   , TYPE_R     , OP(0x33, 4, 0x01) },
+  { "divu"  , TYPE_R     , OP(0x33, 5, 0x01) },
+  { "rem"   , TYPE_R     , OP(0x33, 6, 0x01) },
+  { "remu"  , TYPE_R     , OP(0x33, 7, 0x01) },
+};
+
+static int enabled[ARRLEN(table)];
+static int nr_enabled = 0;
+
+static uint64_t rng_state = 1;
+
+// xorshift64*
+static uint32_t rnd() {
+  rng_state ^= rng_state >> 12;
+  rng_state ^= rng_state << 25;
+  rng_state ^= rng_state >> 27;
+  return (rng_state * 0x2545f4914f6cdd1dull) >> 32;
+}
+
+static uint32_t mask_of(int type) {
+  switch (type) {
+    case TYPE_R: case TYPE_SHIFT: return 0xfe00707f;
+    case TYPE_U: case TYPE_JAL: return 0x7f;
+    default: return 0x707f;
+  }
+}
+
+static const char *name_of(uint32_t inst) {
+  for (int i = 0; i < ARRLEN(table); i ++) {
+    if ((inst & mask_of(table[i].type)) == table[i].match) return table[i].name;
+  }
+  return "???";
+}
+
+static uint32_t enc_s(uint32_t imm) {
+  return (((imm >> 5) & 0x7f) << 25) | ((imm & 0x1f) << 7);
+}
+
+static uint32_t enc_b(uint32_t imm) {
+  return (((imm >> 12) & 1) << 31) | (((imm >> 5) & 0x3f) << 25) |
+         (((imm >> 1) & 0xf) << 8) | (((imm >> 11) & 1) << 7);
+}
+
+static uint32_t enc_j(uint32_t imm) {
+  return (((imm >> 20) & 1) << 31) | (((imm >> 1) & 0x3ff) << 21) |
+         (((imm >> 11) & 1) << 20) | (((imm >> 12) & 0xff) << 12);
+}
+
+static uint32_t dec_b(uint32_t inst) {
+  return (((inst >> 31) & 1) << 12) | (((inst >> 25) & 0x3f) << 5) |
+         (((inst >> 8) & 0xf) << 1) | (((inst >> 7) & 1) << 11);
+}
+
+static uint32_t dec_j(uint32_t inst) {
+  return (((inst >> 31) & 1) << 20) | (((inst >> 21) & 0x3ff) << 1) |
+         (((inst >> 20) & 1) << 11) | (((inst >> 12) & 0xff) << 12);
+}
+
+// generate the instruction at index `i` of a program of `len` instructions
+static uint32_t gen_inst(int i, int len) {
+  const InstPattern *p = &table[enabled[rnd() % nr_enabled]];
+  uint32_t rd = rnd() % 31; // never BASE_REG
+  uint32_t rs1 = rnd() % 32, rs2 = rnd() % 32;
+  uint32_t imm = rnd();
+  uint32_t offset = 4 * (1 + rnd() % (len - i < 8 ? len - i : 8)); // forward, up to the end
+  // aligned, and inside the data area from BASE_REG
+  uint32_t mem_off = (uint32_t)((int32_t)(rnd() % DATA_SIZE) - DATA_SIZE / 2) & ~(uint32_t)(p->size - 1);
+
+  switch (p->type) {
+    case TYPE_R:      return p->match | (rd << 7) | (rs1 << 15) | (rs2 << 20);
+    case TYPE_I:      return p->match | (rd << 7) | (rs1 << 15) | ((imm & 0xfff) << 20);
+    case TYPE_SHIFT:  return p->match | (rd << 7) | (rs1 << 15) | ((imm & 0x1f) << 20);
+    case TYPE_U:      return p->match | (rd << 7) | (imm & 0xfffff000);
+    case TYPE_LOAD:   return p->match | (rd << 7) | (BASE_REG << 15) | ((mem_off & 0xfff) << 20);
+    case TYPE_STORE:  return p->match | enc_s(mem_off) | (BASE_REG << 15) | (rs2 << 20);
+    case TYPE_BRANCH: return p->match | enc_b(offset) | (rs1 << 15) | (rs2 << 20);
+    case TYPE_JAL:    return p->match | enc_j(offset) | (rd << 7);
+    default: assert(0);
+  }
+}
+
+static void gen_program(Program *p, int len) {
+  p->len = len;
+  for (int i = 0; i < len; i ++) p->code[i] = gen_inst(i, len);
+  p->regs.gpr[0] = 0;
+  for (int i = 1; i < 32; i ++) {
+    // small values make more interesting comparisons and shifts
+    uint32_t r = rnd();
+    p->regs.gpr[i] = (r & 1 ? rnd() : (int32_t)(rnd() % 64) - 32);
+  }
+  p->regs.gpr[BASE_REG] = DATA_BASE + DATA_SIZE / 2;
+  p->regs.pc = PROG_BASE;
+  for (int i = 0; i < DATA_SIZE; i += 4) {
+    uint32_t r = rnd();
+    memcpy(p->data + i, &r, 4);
+  }
+}
+
+// ----------- checker -----------
+
+static Sim load_sim(const char *so) {
+  void *handle = dlopen(so, RTLD_LAZY | RTLD_LOCAL);
+  if (handle == NULL) {
+    fprintf(stderr, "%s\n", dlerror());
+    exit(1);
+  }
+  Sim s;
+  s.copy_mem = dlsym(handle, "difftest_memcpy");
+  s.copy_reg = dlsym(handle, "difftest_regcpy");
+  s.exec = dlsym(handle, "difftest_exec");
+  void (*init)(int) = dlsym(handle, "difftest_init");
+  assert(s.copy_mem && s.copy_reg && s.exec && init);
+  init(0);
+  return s;
+}
+
+static Sim dut, ref;
+
+enum { OK, REG_DIFF, MEM_DIFF };
+
+// run the program on both sides and return how they diverge,
+// with the index of the diverging instruction in `idx`
+static int run(Program *p, uint64_t *nr_inst, int *idx) {
+  Sim *sims[] = { &dut, &ref };
+  for (int i = 0; i < 2; i ++) {
+    sims[i]->copy_mem(PROG_BASE, p->code, p->len * 4, DIFFTEST_TO_REF);
+    sims[i]->copy_mem(DATA_BASE, p->data, DATA_SIZE, DIFFTEST_TO_REF);
+    sims[i]->copy_reg(&p->regs, DIFFTEST_TO_REF);
+  }
+
+  uint32_t pc = PROG_BASE;
+  for (int n = 0; n < p->len && pc - PROG_BASE < p->len * 4; n ++) {
+    dut.exec(1);
+    ref.exec(1);
+    (*nr_inst) ++;
+    RegFile a, b;
+    dut.copy_reg(&a, DIFFTEST_TO_DUT);
+    ref.copy_reg(&b, DIFFTEST_TO_DUT);
+    if (memcmp(&a, &b, sizeof(a)) != 0) {
+      *idx = (pc - PROG_BASE) / 4;
+      return REG_DIFF;
+    }
+    pc = a.pc;
+  }
+
+  static uint8_t a[DATA_SIZE], b[DATA_SIZE];
+  dut.copy_mem(DATA_BASE, a, DATA_SIZE, DIFFTEST_TO_DUT);
+  ref.copy_mem(DATA_BASE, b, DATA_SIZE, DIFFTEST_TO_DUT);
+  *idx = p->len - 1;
+  return memcmp(a, b, DATA_SIZE) == 0 ? OK : MEM_DIFF;
+}
+
+// remove the instruction at index `i`, and shorten the forward branches
+// and jumps over it, so that they still reach the same instructions
+static void delete_inst(Program *p, int i) {
+  for (int j = 0; j < i; j ++) {
+    uint32_t inst = p->code[j];
+    if ((inst & 0x7f) == 0x63) {
+      uint32_t off = dec_b(inst);
+      if (j + off / 4 > i) p->code[j] = (inst & ~enc_b(~0u)) | enc_b(off - 4);
+    } else if ((inst & 0x7f) == 0x6f) {
+      uint32_t off = dec_j(inst);
+      if (j + off / 4 > i) p->code[j] = (inst & ~enc_j(~0u)) | enc_j(off - 4);
+    }
+  }
+  memmove(p->code + i, p->code + i + 1, (p->len - i - 1) * 4);
+  p->len --;
+}
+
+// Delete instructions as long as the program diverges in the same way,
+// i.e. in the same kind of state, and for registers also at the same
+// instruction. Replacing them with a nop instead would bring in addi,
+// which may not be among the instructions under test.
+static void shrink(Program *p) {
+  uint64_t nr_inst = 0;
+  int idx;
+  int kind = run(p, &nr_inst, &idx);
+  if (kind == REG_DIFF) p->len = idx + 1;
+  // the diverging instruction, which is kept
+  int sig = (kind == REG_DIFF ? idx : -1);
+  static Program t;
+  bool progress = true;
+  while (progress) {
+    progress = false;
+    for (int i = p->len - 1; i >= 0; i --) {
+      if (i == sig) continue;
+      t = *p;
+      delete_inst(&t, i);
+      int t_sig = (sig > i ? sig - 1 : sig);
+      if (run(&t, &nr_inst, &idx) == kind && (kind != REG_DIFF || idx == t_sig)) {
+        *p = t;
+        sig = t_sig;
+        progress = true;
+      }
+    }
+  }
+}
+
+// The reproducer is an image loaded at CODE_BASE. It sets up the registers
+// with a prologue, runs the program at PROG_BASE, and ends with ebreak.
+// The data area follows at DATA_BASE.
+static void save_reproducer(Program *p, const char *file) {
+  static uint32_t img[(DATA_BASE - CODE_BASE + DATA_SIZE) / 4];
+  memset(img, 0, sizeof(img));
+  int n = 0;
+  for (int i = 1; i < 32; i ++) {
+    uint32_t v = p->regs.gpr[i];
+    uint32_t hi = (v + 0x800) & 0xfffff000, lo = v & 0xfff;
+    img[n ++] = 0x37 | (i << 7) | hi;                               // lui  xi, hi
+    img[n ++] = OP(0x13, 0, 0) | (i << 7) | (i << 15) | (lo << 20); // addi xi, xi, lo
+  }
+  while (CODE_BASE + n * 4 < PROG_BASE) img[n ++] = NOP;
+  memcpy(img + n, p->code, p->len * 4);
+  img[n + p->len] = EBREAK;
+  memcpy((uint8_t *)img + (DATA_BASE - CODE_BASE), p->data, DATA_SIZE);
+
+  FILE *fp = fopen(file, "wb");
+  assert(fp != NULL);
+  int ret = fwrite(img, sizeof(img), 1, fp);
+  assert(ret == 1);
+  fclose(fp);
+}
+
+static void report(Program *p, int kind, uint64_t seed, uint64_t nr_prog) {
+  char file[64];
+  snprintf(file, sizeof(file), "isa-fuzz-%" PRIu64 "-%" PRIu64 ".bin", seed, nr_prog);
+  save_reproducer(p, file);
+
+  printf("Program %" PRIu64 " of seed %" PRIu64 " diverges in %s, shrunk to:\n",
+      nr_prog, seed, kind == REG_DIFF ? "registers" : "memory");
+  for (int i = 0; i < p->len; i ++) {
+    printf("  0x%08x: %08x  %s\n", PROG_BASE + i * 4, p->code[i], name_of(p->code[i]));
+  }
+  printf("The reproducer is saved to %s\n", file);
+  fflush(stdout);
+}
+
+// ----------- workers -----------
+
+typedef struct {
+  uint64_t nr_prog;
+  uint64_t nr_inst;
+  bool found;
+} Stat;
+
+static Stat *stats = NULL; // shared with the workers
+
+static void worker(int id, uint64_t seed, uint64_t nr_prog, int len, const char *dut_so, const char *ref_so) {
+  dut = load_sim(dut_so);
+  ref = load_sim(ref_so);
+  rng_state = seed ? seed : 1;
+
+  static Program p;
+  uint64_t nr_inst = 0;
+  for (uint64_t i = 0; nr_prog == 0 || i < nr_prog; i ++) {
+    gen_program(&p, len);
+    int idx;
+    int kind = run(&p, &nr_inst, &idx);
+    if (kind != OK) {
+      shrink(&p);
+      report(&p, kind, seed, i);
+      __atomic_store_n(&stats[id].found, true, __ATOMIC_RELEASE);
+      exit(1);
+    }
+    if ((i & 0xff) == 0xff) {
+      __atomic_store_n(&stats[id].nr_prog, i + 1, __ATOMIC_RELAXED);
+      __atomic_store_n(&stats[id].nr_inst, nr_inst, __ATOMIC_RELAXED);
+    }
+  }
+  __atomic_store_n(&stats[id].nr_prog, nr_prog, __ATOMIC_RELAXED);
+  __atomic_store_n(&stats[id].nr_inst, nr_inst, __ATOMIC_RELAXED);
+  exit(0);
+}
+
+static uint64_t get_time() {
+  struct timeval now;
+  gettimeofday(&now, NULL);
+  return now.tv_sec * 1000000ull + now.tv_usec;
+}
+
+static void enable_insts(char *list) {
+  nr_enabled = 0;
+  for (char *name = strtok(list, ","); name != NULL; name = strtok(NULL, ",")) {
+    int i;
+    for (i = 0; i < ARRLEN(table); i ++) {
+      if (strcmp(name, table[i].name) == 0) break;
+    }
+    if (i == ARRLEN(table)) {
+      fprintf(stderr, "Unknown instruction '%s'\n", name);
+      exit(1);
+    }
+    enabled[nr_enabled ++] = i;
+  }
+}
+
+int main(int argc, char *argv[]) {
+  int nr_job = sysconf(_SC_NPROCESSORS_ONLN);
+  uint64_t nr_prog = 0;
+  int len = 64;
+  uint64_t seed = time(NULL);
+  for (int i = 0; i < ARRLEN(table); i ++) enabled[nr_enabled ++] = i;
+
+  const struct option options[] = {
+    {"jobs"   , required_argument, NULL, 'j'},
+    {"num"    , required_argument, NULL, 'n'},
+    {"len"    , required_argument, NULL, 'l'},
+    {"seed"   , required_argument, NULL, 's'},
+    {"only"   , required_argument, NULL, 'o'},
+    {0        , 0                , NULL,  0 },
+  };
+  int o;
+  while ((o = getopt_long(argc, argv, "j:n:l:s:o:", options, NULL)) != -1) {
+    switch (o) {
+      case 'j': nr_job = atoi(optarg); break;
+      case 'n': nr_prog = strtoull(optarg, NULL, 0); break;
+      case 'l': len = atoi(optarg); break;
+      case 's': seed = strtoull(optarg, NULL, 0); break;
+      case 'o': enable_insts(optarg); break;
+      default: goto usage;
+    }
+  }
+  if (argc - optind != 2 || nr_job < 1 || len < 1 || len > MAX_LEN || nr_enabled == 0) {
+usage:
+    printf("Usage: %s [OPTION...] DUT_SO REF_SO\n\n", argv[0]);
+    printf("\t-j,--jobs=N         run N pairs of simulators in parallel\n");
+    printf("\t-n,--num=N          run N programs in total, or forever if N is 0 (default)\n");
+    printf("\t-l,--len=N          generate programs of N instructions (default 64)\n");
+    printf("\t-s,--seed=N         seed the generator with N, and worker i with N + i\n");
+    printf("\t-o,--only=I1,I2...  only generate the given instructions\n");
+    printf("\nDUT_SO and REF_SO are shared objects exporting the difftest REF API,\n"
+           "and they must be different files so that they do not share states.\n");
+    return 1;
+  }
+  const char *dut_so = argv[optind], *ref_so = argv[optind + 1];
+
+  stats = mmap(NULL, sizeof(Stat) * nr_job, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+  assert(stats != MAP_FAILED);
+  memset(stats, 0, sizeof(Stat) * nr_job);
+
+  printf("Run %d jobs with seed %" PRIu64 "\n", nr_job, seed);
+  fflush(stdout);
+  pid_t pids[nr_job];
+  for (int i = 0; i < nr_job; i ++) {
+    uint64_t n = nr_prog / nr_job + (i < nr_prog % nr_job);
+    if (nr_prog != 0 && n == 0) { pids[i] = -1; continue; }
+    pids[i] = fork();
+    assert(pids[i] >= 0);
+    if (pids[i] == 0) worker(i, seed + i, (nr_prog == 0 ? 0 : n), len, dut_so, ref_so);
+  }
+
+  uint64_t start = get_time();
+  int nr_alive = 0, found = 0;
+  for (int i = 0; i < nr_job; i ++) nr_alive += (pids[i] > 0);
+  while (nr_alive > 0) {
+    sleep(1);
+    int status;
+    while (waitpid(-1, &status, WNOHANG) > 0) {
+      nr_alive --;
+      if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) found = 1;
+    }
+
+    uint64_t progs = 0, insts = 0;
+    for (int i = 0; i < nr_job; i ++) {
+      progs += __atomic_load_n(&stats[i].nr_prog, __ATOMIC_RELAXED);
+      insts += __atomic_load_n(&stats[i].nr_inst, __ATOMIC_RELAXED);
+    }
+    double sec = (get_time() - start) / 1e6;
+    printf("%" PRIu64 " programs, %" PRIu64 " instructions, %.0f programs/s, %.0f inst/s\n",
+        progs, insts, progs / sec, insts / sec);
+    fflush(stdout);
+
+    if (found) {
+      for (int i = 0; i < nr_job; i ++) {
+        if (pids[i] > 0) kill(pids[i], SIGTERM);
+      }
+      while (wait(NULL) > 0);
+      return 1;
+    }
+  }
+  return 0;
+}
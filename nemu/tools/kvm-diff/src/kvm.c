@@ -15,13 +15,17 @@
 
 // from NEMU
 #include <memory/paddr.h>
+#include <memory/vaddr.h>
+#include <utils.h>
 #include <isa-def.h>
 #include <difftest-def.h>
 
 #include <fcntl.h>
 #include <errno.h>
+#include <signal.h>
 #include <sys/ioctl.h>
 #include <sys/mman.h>
+#include <sys/time.h>
 #include <linux/kvm.h>
 
 /* CR0 bits */
@@ -40,6 +44,7 @@ struct vm {
   int fd;
   uint8_t *mem;
   uint8_t *mmio;
+  uint64_t *dirty_bitmap; // pages of `mem` written by the guest
 };
 
 struct vcpu {
@@ -73,6 +78,18 @@ static void kvm_set_step_mode(bool watch, uint32_t watch_addr) {
   }
 }
 
+// run freely, and stop before the instruction at `bp_addr` is fetched
+static void kvm_set_run_mode(uint32_t bp_addr) {
+  struct kvm_guest_debug debug = {};
+  debug.control = KVM_GUESTDBG_ENABLE | KVM_GUESTDBG_USE_HW_BP;
+  debug.arch.debugreg[0] = bp_addr;
+  debug.arch.debugreg[7] = 0x1;
+  if (ioctl(vcpu.fd, KVM_SET_GUEST_DEBUG, &debug) < 0) {
+    perror("KVM_SET_GUEST_DEBUG");
+    assert(0);
+  }
+}
+
 static void kvm_setregs(const struct kvm_regs *r) {
   if (ioctl(vcpu.fd, KVM_SET_REGS, r) < 0) {
     perror("KVM_SET_REGS");
@@ -95,7 +112,7 @@ static void kvm_setsregs(const struct kvm_sregs *r) {
   }
 }
 
-static void* create_mem(int slot, uintptr_t base, size_t mem_size) {
+static void* create_mem(int slot, uintptr_t base, size_t mem_size, uint32_t flags) {
   void *mem = mmap(NULL, mem_size, PROT_READ | PROT_WRITE,
       MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
   if (mem == MAP_FAILED) {
@@ -107,7 +124,7 @@ static void* create_mem(int slot, uintptr_t base, size_t mem_size) {
 
   struct kvm_userspace_memory_region memreg;
   memreg.slot = slot;
-  memreg.flags = 0;
+  memreg.flags = flags;
   memreg.guest_phys_addr = base;
   memreg.memory_size = mem_size;
   memreg.userspace_addr = (unsigned long)mem;
@@ -150,8 +167,11 @@ static void vm_init(size_t mem_size) {
     assert(0);
   }
 
-  vm.mem = create_mem(0, 0, mem_size);
-  vm.mmio = create_mem(1, 0xa1000000, 0x1000);
+  // log the pages written by the guest, so that only they are compared with DUT
+  vm.mem = create_mem(0, 0, mem_size, KVM_MEM_LOG_DIRTY_PAGES);
+  vm.mmio = create_mem(1, 0xa1000000, 0x1000, 0);
+  vm.dirty_bitmap = calloc((mem_size / PAGE_SIZE + 63) / 64, sizeof(uint64_t));
+  assert(vm.dirty_bitmap);
 }
 
 static void vcpu_init() {
@@ -351,6 +371,27 @@ __EXPORT void difftest_memcpy(paddr_t addr, void *buf, size_t n, bool direction)
   else memcpy(buf, vm.mem + addr, n);
 }
 
+__EXPORT uint64_t difftest_memhash(paddr_t addr, size_t n) {
+  return hash64(vm.mem + addr, n, HASH64_INIT);
+}
+
+// Add the pages written by the guest since the last call to `map`. Note
+// that the writes by difftest_memcpy() are not logged, since they come
+// from DUT. The guest memory starts at 0, which is also CONFIG_MBASE of x86.
+__EXPORT void difftest_memdirty(uint64_t *map, size_t nr_page) {
+  struct kvm_dirty_log log = { .slot = 0, .dirty_bitmap = vm.dirty_bitmap };
+  if (ioctl(vm.fd, KVM_GET_DIRTY_LOG, &log) < 0) {
+    perror("KVM_GET_DIRTY_LOG");
+    assert(0);
+  }
+  if (nr_page > CONFIG_MSIZE / PAGE_SIZE) nr_page = CONFIG_MSIZE / PAGE_SIZE;
+  size_t i;
+  size_t nr_word = (nr_page + 63) / 64;
+  for (i = 0; i < nr_word; i ++) {
+    map[i] |= vm.dirty_bitmap[i];
+  }
+}
+
 __EXPORT void difftest_regcpy(void *r, bool direction) {
   struct kvm_regs *ref = &(vcpu.kvm_run->s.regs.regs);
   x86_CPU_state *x86 = r;
@@ -383,6 +424,61 @@ __EXPORT void difftest_exec(uint64_t n) {
   kvm_exec(n);
 }
 
+// A free run which does not reach the breakpoint, e.g. after REF diverges
+// from DUT, is stopped by SIGALRM, which makes KVM_RUN return EINTR. The
+// registers of REF then differ from DUT, and DUT bisects the batch with
+// difftest_exec().
+#define RUN_TIMEOUT_US 100000
+
+static void alarm_handler(int signum) { }
+
+// Instead of single-stepping `n` times, run freely with a hardware
+// breakpoint at `pc` until REF arrives there for the (nr_visit + 1)-th
+// time. The patching of pushf, popf and iret above is not done in a free
+// run, where they see the real flags without TF. Interrupts and iret
+// waiting for their watchpoint are still single-stepped.
+__EXPORT void difftest_exec_to(uint64_t n, vaddr_t pc, uint64_t nr_visit) {
+  if (vcpu.int_wp_state != STATE_IDLE) {
+    kvm_exec(n);
+    return;
+  }
+  struct kvm_regs *r = &vcpu.kvm_run->s.regs.regs;
+  uint64_t nr_arrive = 0;
+  while (true) {
+    if (r->rip == pc) {
+      if (++ nr_arrive > nr_visit) return;
+      // step over the breakpoint
+      kvm_exec(1);
+      continue;
+    }
+
+    r->rflags &= ~RFLAGS_TF;
+    vcpu.kvm_run->kvm_dirty_regs = KVM_SYNC_X86_REGS;
+    kvm_set_run_mode(pc);
+    struct itimerval it = { .it_value = { .tv_usec = RUN_TIMEOUT_US } };
+    setitimer(ITIMER_REAL, &it, NULL);
+    int ret = ioctl(vcpu.fd, KVM_RUN, 0);
+    int err = errno;
+    it.it_value.tv_usec = 0;
+    setitimer(ITIMER_REAL, &it, NULL);
+    r->rflags |= RFLAGS_TF;
+    vcpu.kvm_run->kvm_dirty_regs = KVM_SYNC_X86_REGS;
+    kvm_set_step_mode(false, 0);
+
+    if (ret < 0) {
+      if (err == EINTR) return;
+      perror("KVM_RUN");
+      assert(0);
+    }
+    if (vcpu.kvm_run->exit_reason == KVM_EXIT_HLT) return;
+    if (vcpu.kvm_run->exit_reason != KVM_EXIT_DEBUG) {
+      fprintf(stderr, "Got exit_reason %d at pc = 0x%llx, expected KVM_EXIT_DEBUG (%d)\n",
+          vcpu.kvm_run->exit_reason, r->rip, KVM_EXIT_DEBUG);
+      assert(0);
+    }
+  }
+}
+
 __EXPORT void difftest_raise_intr(word_t NO) {
   uint32_t pgate_vaddr = vcpu.kvm_run->s.regs.sregs.idt.base + NO * 8;
   uint32_t pgate = va2pa(pgate_vaddr);
@@ -403,6 +499,8 @@ __EXPORT void difftest_raise_intr(word_t NO) {
 }
 
 __EXPORT void difftest_init(int port) {
+  struct sigaction sa = { .sa_handler = alarm_handler };
+  sigaction(SIGALRM, &sa, NULL);
   vm_init(CONFIG_MSIZE);
   vcpu_init();
   run_protected_mode();
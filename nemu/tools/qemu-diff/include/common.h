@@ -23,8 +23,14 @@
 #include <stdio.h>
 #include <unistd.h>
 #include <stdlib.h>
+#include <generated/autoconf.h>
 
 typedef uint32_t paddr_t;
+#ifdef CONFIG_ISA64
+typedef uint64_t vaddr_t;
+#else
+typedef uint32_t vaddr_t;
+#endif
 
 #include "isa.h"
 #include "protocol.h"
@@ -16,26 +16,43 @@
 #ifndef __ISA_H__
 #define __ISA_H__
 
+// ISA_PC_REGNUM is the number of pc in the 'p' packet and the stop reply
+// of gdb, and ISA_BP_KIND is the kind of a software breakpoint
 #if defined(CONFIG_ISA_mips32)
 #define ISA_QEMU_BIN "qemu-system-mipsel"
 #define ISA_QEMU_ARGS "-machine", "mipssim",\
   "-kernel", NEMU_HOME "/resource/mips-elf/mips.dummy",
+#define ISA_PC_REGNUM 37
+#define ISA_BP_KIND 4
 #elif defined(CONFIG_ISA_riscv) && !defined(CONFIG_RV64)
 #define ISA_QEMU_BIN "qemu-system-riscv32"
 #define ISA_QEMU_ARGS "-bios", "none",
+#define ISA_PC_REGNUM 32
+#define ISA_BP_KIND 4
 #elif defined(CONFIG_ISA_riscv) && defined(CONFIG_RV64)
 #define ISA_QEMU_BIN "qemu-system-riscv64"
 #define ISA_QEMU_ARGS 
+#define ISA_PC_REGNUM 32
+#define ISA_BP_KIND 4
 #elif defined(CONFIG_ISA_x86)
 #define ISA_QEMU_BIN "qemu-system-i386"
 #define ISA_QEMU_ARGS
+#define ISA_PC_REGNUM 8
+#define ISA_BP_KIND 1
+#define ISA_GDB_PC eip
 #elif defined(CONFIG_ISA_loongarch32r)
 #define ISA_QEMU_BIN "qemu-system-loongarch32"
 #define ISA_QEMU_ARGS "-M","ls3a5k32",
+#define ISA_PC_REGNUM 32
+#define ISA_BP_KIND 4
 #else
 #error Unsupport ISA
 #endif
 
+#ifndef ISA_GDB_PC
+#define ISA_GDB_PC pc
+#endif
+
 union isa_gdb_regs {
   struct {
 #if defined(CONFIG_ISA_mips32)
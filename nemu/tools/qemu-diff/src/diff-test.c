@@ -23,6 +23,9 @@ bool gdb_memcpy_to_qemu(uint32_t, void *, int);
 bool gdb_getregs(union isa_gdb_regs *);
 bool gdb_setregs(union isa_gdb_regs *);
 bool gdb_si();
+uint64_t gdb_getpc();
+bool gdb_break(uint64_t addr, bool insert);
+void gdb_cont(uint32_t timeout_us);
 void gdb_exit();
 
 void init_isa();
@@ -50,6 +53,35 @@ __EXPORT void difftest_exec(uint64_t n) {
   while (n --) gdb_si();
 }
 
+// A continue which does not reach the breakpoint, e.g. after QEMU diverges
+// from DUT, is interrupted after this time. The registers of QEMU then
+// differ from DUT, and DUT bisects the batch with difftest_exec().
+#define CONT_TIMEOUT_US 100000
+
+// Instead of stepping `n` times, continue to a temporary breakpoint at
+// `pc` until QEMU arrives there for the (nr_visit + 1)-th time. Like gdb,
+// the breakpoint is only inserted while QEMU runs, so that stepping over
+// it needs no special care.
+__EXPORT void difftest_exec_to(uint64_t n, vaddr_t pc, uint64_t nr_visit) {
+  uint64_t nr_arrive = 0, nr_step = 0;
+  while (true) {
+    if (gdb_getpc() == pc) {
+      if (++ nr_arrive > nr_visit) return;
+      gdb_si();
+      nr_step ++;
+      continue;
+    }
+    if (!gdb_break(pc, true)) {
+      // no breakpoints in QEMU, and it has only stepped so far
+      difftest_exec(n - nr_step);
+      return;
+    }
+    gdb_cont(CONT_TIMEOUT_US);
+    gdb_break(pc, false);
+    if (gdb_getpc() != pc) return; // interrupted
+  }
+}
+
 __EXPORT void difftest_init(int port) {
   char buf[32];
   sprintf(buf, "tcp::%d", port);
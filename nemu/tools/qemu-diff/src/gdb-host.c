@@ -14,105 +14,258 @@
 ***************************************************************************************/
 
 #include "common.h"
+#include <inttypes.h>
+#include <signal.h>
+#include <sys/time.h>
 
 static struct gdb_conn *conn;
 
+// the registers of QEMU, which are valid until QEMU executes instructions
+static union isa_gdb_regs regs_cache;
+static bool regs_cache_valid = false;
+// pc alone is also known after QEMU stops, if the stop reply expedites it
+static uint64_t pc_cache;
+static bool pc_cache_valid = false;
+
 bool gdb_connect_qemu(int port) {
   // connect to gdbserver on localhost port 1234
   while ((conn = gdb_begin_inet("127.0.0.1", port)) == NULL) {
     usleep(1);
   }
 
+  // without acks, packets can be sent back-to-back before reading the replies
+  gdb_start_noack(conn);
+
   return true;
 }
 
-static bool gdb_memcpy_to_qemu_small(uint32_t dest, void *src, int len) {
+static bool gdb_recv_ok() {
+  size_t size;
+  uint8_t *reply = gdb_recv(conn, &size);
+  bool ok = !strcmp((const char*)reply, "OK");
+  free(reply);
+  return ok;
+}
+
+static void gdb_send_memcpy_hex(uint32_t dest, uint8_t *src, int len) {
   char *buf = malloc(len * 2 + 128);
   assert(buf != NULL);
-  int p = sprintf(buf, "M0x%x,%x:", dest, len);
+  int p = sprintf(buf, "M%x,%x:", dest, len);
   int i;
   for (i = 0; i < len; i ++) {
-    p += sprintf(buf + p, "%c%c", hex_encode(((uint8_t *)src)[i] >> 4), hex_encode(((uint8_t *)src)[i] & 0xf));
+    buf[p ++] = hex_encode(src[i] >> 4);
+    buf[p ++] = hex_encode(src[i] & 0xf);
   }
-
-  gdb_send(conn, (const uint8_t *)buf, strlen(buf));
+  gdb_send(conn, (const uint8_t *)buf, p);
   free(buf);
+}
 
-  size_t size;
-  uint8_t *reply = gdb_recv(conn, &size);
-  bool ok = !strcmp((const char*)reply, "OK");
-  free(reply);
+// binary data in an 'X' packet, with '#', '$', '}' and '*' escaped
+static void gdb_send_memcpy_bin(uint32_t dest, uint8_t *src, int len) {
+  char *buf = malloc(len * 2 + 128);
+  assert(buf != NULL);
+  int p = sprintf(buf, "X%x,%x:", dest, len);
+  int i;
+  for (i = 0; i < len; i ++) {
+    uint8_t c = src[i];
+    if (c == '#' || c == '$' || c == '}' || c == '*') {
+      buf[p ++] = '}';
+      c ^= 0x20;
+    }
+    buf[p ++] = c;
+  }
+  gdb_send(conn, (const uint8_t *)buf, p);
+  free(buf);
+}
 
-  return ok;
+// probe whether QEMU supports 'X' packets with an empty write
+static bool gdb_support_binary() {
+  static int support = -1;
+  if (support == -1) {
+    gdb_send(conn, (const uint8_t *)"X0,0:", 5);
+    support = gdb_recv_ok();
+  }
+  return support;
 }
 
 bool gdb_memcpy_to_qemu(uint32_t dest, void *src, int len) {
-  const int mtu = 1500;
+  // QEMU holds a packet in a 4096-byte buffer, which an escaped or
+  // hex-encoded chunk of this size always fits in
+  const int chunk = 2000;
+  // the number of packets sent before their replies are read,
+  // keep it small enough for the replies to fit in the socket buffer
+  const int window = 64;
+  void (*send)(uint32_t, uint8_t *, int) =
+    (gdb_support_binary() ? gdb_send_memcpy_bin : gdb_send_memcpy_hex);
   bool ok = true;
-  while (len > mtu) {
-    ok &= gdb_memcpy_to_qemu_small(dest, src, mtu);
-    dest += mtu;
-    src += mtu;
-    len -= mtu;
+  int nr_pending = 0;
+  while (len > 0) {
+    int n = (len > chunk ? chunk : len);
+    send(dest, src, n);
+    dest += n;
+    src += n;
+    len -= n;
+    if (++ nr_pending == window) {
+      for (; nr_pending > 0; nr_pending --) ok &= gdb_recv_ok();
+    }
   }
-  ok &= gdb_memcpy_to_qemu_small(dest, src, len);
+  for (; nr_pending > 0; nr_pending --) ok &= gdb_recv_ok();
   return ok;
 }
 
+// a register in the byte order of the target, which is little-endian
+static uint64_t gdb_decode_reg(const uint8_t *hex, size_t len) {
+  uint64_t v = 0;
+  for (int i = 0; i < 8 && 2 * i + 1 < len; i ++) {
+    uint16_t byte = gdb_decode_hex(hex[2 * i], hex[2 * i + 1]);
+    if (byte == UINT16_MAX) break;
+    v |= (uint64_t)byte << (8 * i);
+  }
+  return v;
+}
+
+// Take pc from a stop reply like "T05thread:01;20:00000080;", where the
+// number before ':' is the register, and the rest are key:value pairs.
+static void gdb_parse_stop(uint8_t *reply, size_t size) {
+  regs_cache_valid = false;
+  pc_cache_valid = false;
+  if (size < 3 || reply[0] != 'T') return;
+  char *p = (char *)reply + 3;
+  while (*p != '\0') {
+    char *colon = strchr(p, ':');
+    char *semi = strchr(p, ';');
+    if (colon == NULL) return;
+    if (semi == NULL) semi = p + strlen(p);
+    char *end;
+    long n = strtol(p, &end, 16);
+    if (end == colon && n == ISA_PC_REGNUM) {
+      pc_cache = gdb_decode_reg((uint8_t *)colon + 1, semi - colon - 1);
+      pc_cache_valid = true;
+    }
+    if (*semi == '\0') return;
+    p = semi + 1;
+  }
+}
+
 bool gdb_getregs(union isa_gdb_regs *r) {
+  if (regs_cache_valid) {
+    *r = regs_cache;
+    return true;
+  }
+
   gdb_send(conn, (const uint8_t *)"g", 1);
   size_t size;
   uint8_t *reply = gdb_recv(conn, &size);
 
+  // registers are sent in the byte order of the target
+  memset(r, 0, sizeof(*r));
+  uint8_t *dst = (uint8_t *)r;
   int i;
-  uint8_t *p = reply;
-  uint8_t c;
-  for (i = 0; i < sizeof(union isa_gdb_regs) / sizeof(uint32_t); i ++) {
-    c = p[8];
-    p[8] = '\0';
-    r->array[i] = gdb_decode_hex_str(p);
-    p[8] = c;
-    p += 8;
+  for (i = 0; i < sizeof(*r) && 2 * i + 1 < size; i ++) {
+    uint16_t byte = gdb_decode_hex(reply[2 * i], reply[2 * i + 1]);
+    dst[i] = (byte == UINT16_MAX ? 0 : byte); // 'x' for unavailable registers
   }
 
   free(reply);
 
+  regs_cache = *r;
+  regs_cache_valid = true;
   return true;
 }
 
+uint64_t gdb_getpc() {
+  if (regs_cache_valid) return regs_cache.ISA_GDB_PC;
+  if (pc_cache_valid) return pc_cache;
+
+  char buf[16];
+  int len = sprintf(buf, "p%x", ISA_PC_REGNUM);
+  gdb_send(conn, (const uint8_t *)buf, len);
+  size_t size;
+  uint8_t *reply = gdb_recv(conn, &size);
+  bool ok = (size > 0 && reply[0] != 'E');
+  if (ok) pc_cache = gdb_decode_reg(reply, size);
+  free(reply);
+  if (!ok) {
+    union isa_gdb_regs r;
+    gdb_getregs(&r);
+    return r.ISA_GDB_PC;
+  }
+  pc_cache_valid = true;
+  return pc_cache;
+}
+
 bool gdb_setregs(union isa_gdb_regs *r) {
+  if (regs_cache_valid && memcmp(&regs_cache, r, sizeof(*r)) == 0) return true;
+
   int len = sizeof(union isa_gdb_regs);
   char *buf = malloc(len * 2 + 128);
   assert(buf != NULL);
   buf[0] = 'G';
 
-  void *src = r;
+  uint8_t *src = (uint8_t *)r;
   int p = 1;
   int i;
   for (i = 0; i < len; i ++) {
-    p += sprintf(buf + p, "%c%c", hex_encode(((uint8_t *)src)[i] >> 4), hex_encode(((uint8_t *)src)[i] & 0xf));
+    buf[p ++] = hex_encode(src[i] >> 4);
+    buf[p ++] = hex_encode(src[i] & 0xf);
   }
 
-  gdb_send(conn, (const uint8_t *)buf, strlen(buf));
+  gdb_send(conn, (const uint8_t *)buf, p);
   free(buf);
 
-  size_t size;
-  uint8_t *reply = gdb_recv(conn, &size);
-  bool ok = !strcmp((const char*)reply, "OK");
-  free(reply);
-
+  bool ok = gdb_recv_ok();
+  regs_cache = *r;
+  regs_cache_valid = ok;
+  pc_cache_valid = false;
   return ok;
 }
 
 bool gdb_si() {
+  // Note that the step packets can not be sent back-to-back like the
+  // memory writes above: QEMU takes any byte arriving while the guest
+  // is running as a request to interrupt it.
   char buf[] = "vCont;s:1";
   gdb_send(conn, (const uint8_t *)buf, strlen(buf));
   size_t size;
   uint8_t *reply = gdb_recv(conn, &size);
+  gdb_parse_stop(reply, size);
   free(reply);
   return true;
 }
 
+bool gdb_break(uint64_t addr, bool insert) {
+  char buf[64];
+  int len = sprintf(buf, "%c0,%" PRIx64 ",%d", insert ? 'Z' : 'z', addr, ISA_BP_KIND);
+  gdb_send(conn, (const uint8_t *)buf, len);
+  return gdb_recv_ok();
+}
+
+// Continue until QEMU stops, e.g. at a breakpoint. If it does not stop
+// within `timeout_us`, it is interrupted, and the stop reply tells so.
+static void gdb_alarm_handler(int signum) {
+  gdb_interrupt(conn);
+}
+
+void gdb_cont(uint32_t timeout_us) {
+  struct sigaction sa = { .sa_handler = gdb_alarm_handler, .sa_flags = SA_RESTART };
+  struct sigaction old_sa;
+  sigaction(SIGALRM, &sa, &old_sa);
+  struct itimerval it = { .it_value = { .tv_sec = timeout_us / 1000000, .tv_usec = timeout_us % 1000000 } };
+  setitimer(ITIMER_REAL, &it, NULL);
+
+  char buf[] = "vCont;c:1";
+  gdb_send(conn, (const uint8_t *)buf, strlen(buf));
+  size_t size;
+  uint8_t *reply = gdb_recv(conn, &size);
+
+  it.it_value.tv_sec = it.it_value.tv_usec = 0;
+  setitimer(ITIMER_REAL, &it, NULL);
+  sigaction(SIGALRM, &old_sa, NULL);
+
+  gdb_parse_stop(reply, size);
+  free(reply);
+}
+
 void gdb_exit() {
   gdb_end(conn);
 }
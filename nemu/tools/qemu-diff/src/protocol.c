@@ -290,6 +290,13 @@ uint8_t* gdb_recv(struct gdb_conn *conn, size_t *size) {
   return reply;
 }
 
+// ask the running target to stop, this is async-signal-safe
+void gdb_interrupt(struct gdb_conn *conn) {
+  const char c = 0x03;
+  int ret = write(fileno(conn->out), &c, 1);
+  (void)ret;
+}
+
 const char* gdb_start_noack(struct gdb_conn *conn) {
   static const char cmd[] = "QStartNoAckMode";
   gdb_send(conn, (const uint8_t *)cmd, sizeof(cmd) - 1);
@@ -16,6 +16,7 @@
 #include "mmu.h"
 #include "sim.h"
 #include "../../include/common.h"
+#include "../../include/utils.h"
 #include <difftest-def.h>
 
 #define NR_GPR MUXDEF(CONFIG_RVE, 16, 32)
@@ -70,21 +71,64 @@ void sim_t::diff_set_regs(void* diff_context) {
   state->pc = ctx->pc;
 }
 
+static mem_t* dram_range(reg_t addr, size_t n) {
+  reg_t base = difftest_mem[0].first;
+  mem_t* mem = difftest_mem[0].second;
+  if (addr < base || addr - base + n > mem->size()) return NULL;
+  return mem;
+}
+
 void sim_t::diff_memcpy(reg_t dest, void* src, size_t n) {
   mmu_t* mmu = p->get_mmu();
+  mem_t* mem = dram_range(dest, n);
+  if (mem != NULL) {
+    // copy into the backing store directly, page by page
+    mem->store(dest - difftest_mem[0].first, n, (const uint8_t*)src);
+    // instructions already decoded from this range are stale now
+    mmu->flush_icache();
+    return;
+  }
   for (size_t i = 0; i < n; i++) {
     mmu->store<uint8_t>(dest+i, *((uint8_t*)src+i));
   }
 }
 
+// sim_t is declared by spike, so this can not be one of its members
+static void diff_memcpy_from_ref(void* dest, reg_t src, size_t n) {
+  mmu_t* mmu = p->get_mmu();
+  mem_t* mem = dram_range(src, n);
+  if (mem != NULL) {
+    mem->load(src - difftest_mem[0].first, n, (uint8_t*)dest);
+    return;
+  }
+  for (size_t i = 0; i < n; i++) {
+    *((uint8_t*)dest+i) = mmu->load<uint8_t>(src+i);
+  }
+}
+
 extern "C" {
 
 __EXPORT void difftest_memcpy(paddr_t addr, void *buf, size_t n, bool direction) {
   if (direction == DIFFTEST_TO_REF) {
     s->diff_memcpy(addr, buf, n);
   } else {
-    assert(0);
+    diff_memcpy_from_ref(buf, addr, n);
+  }
+}
+
+// hash of the memory in [addr, addr + n), computed in the same way as
+// hash64() in NEMU, so that NEMU can compare memory without copying it
+__EXPORT uint64_t difftest_memhash(paddr_t addr, size_t n) {
+  uint8_t buf[4096];
+  uint64_t h = HASH64_INIT;
+  while (n > 0) {
+    size_t len = (n < sizeof(buf) ? n : sizeof(buf));
+    diff_memcpy_from_ref(buf, addr, len);
+    h = hash64(buf, len, h);
+    addr += len;
+    n -= len;
   }
+  return h;
 }
 
 __EXPORT void difftest_regcpy(void* dut, bool direction) {